@@ -5,12 +5,66 @@
  * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
  */
 
+// Scripts often run this once per key, so startup is kept lean: no iostreams
+// (and their static initialization), and one unbuffered write per key.
+
+#include "key-bus.h"
 #include "read-kb.h"
 
-#include <iostream>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/// Write the name of a key and a newline to standard output
+static void printKey(const ReadKB::Key &key) {
+  char name[ReadKB::Key::kMaxNameLength + 1];
+  size_t len = key.format(name, ReadKB::Key::kMaxNameLength);
+  name[len] = '\n';
+  if (write(STDOUT_FILENO, name, len + 1) == -1) {
+    perror("write");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s                          Print the name of one key\n"
+                  "       %s --publish NAME [CAPACITY] Publish keys to shared memory until end of input\n"
+                  "       %s --subscribe NAME          Print keys published to shared memory until it closes\n",
+          prog, prog, prog);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 1) {
+    ReadKB kb;
+    printKey(kb.read_key());
+    return EXIT_SUCCESS;
+  }
+
+  if (argc >= 3 && argc <= 4 && strcmp(argv[1], "--publish") == 0) {
+    KeyBus::Publisher bus(argv[2], argc == 4 ? strtoull(argv[3], nullptr, 10) : 1024);
+    ReadKB kb;
+    for (ReadKB::Key key = kb.read_key(); !kb.eof(); key = kb.read_key()) {
+      bus.publish(key);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (argc == 3 && strcmp(argv[1], "--subscribe") == 0) {
+    KeyBus::Subscriber bus(argv[2]);
+    KeyBus::Record rec;
+    for (KeyBus::Subscriber::Status status = bus.wait(rec); status != KeyBus::Subscriber::Status::Closed;
+         status = bus.wait(rec)) {
+      if (status == KeyBus::Subscriber::Status::Overrun) {
+        fprintf(stderr, "Overrun: %llu keys dropped\n", static_cast<unsigned long long>(bus.dropped()));
+        continue;
+      }
+      printKey(ReadKB::Key(rec.key));
+    }
+    return EXIT_SUCCESS;
+  }
 
-int main() {
-  ReadKB kb;
-  std::cout << kb.read_key() << std::endl;
-  return EXIT_SUCCESS;
+  usage(argv[0]);
+  return EXIT_FAILURE;
 }
@@ -0,0 +1,138 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+// Measure the exec-to-exit time and system call count of a one-shot read-kb
+// run, reading a single key from a pseudo-terminal as it would interactively
+
+#include "error-if.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// Start `prog` with one key waiting on a terminal as standard input (so the terminal attributes are
+/// switched and restored as usual) and output discarded, returning the pseudo-terminal master in `master`
+static pid_t spawn(const char *prog, const bool &traced, int &master) {
+  master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  errorIf(master == -1 || grantpt(master) == -1 || unlockpt(master) == -1, "posix_openpt");
+  int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  errorIf(slave == -1, "open pty");
+  // Buffered until the program leaves canonical mode
+  errorIf(write(master, "a", 1) != 1, "write");
+
+  pid_t pid = fork();
+  errorIf(pid == -1, "fork");
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (dup2(slave, STDIN_FILENO) == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+      _exit(127);
+    }
+    close(slave);
+    close(null_fd);
+    if (traced && ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) == -1) {
+      _exit(127);
+    }
+    execl(prog, prog, static_cast<char*>(nullptr));
+    _exit(127);
+  }
+  close(slave);
+  return pid;
+}
+
+static void checkExit(const int &status) {
+  errorIf((!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) && (errno = ECHILD), "benchmarked program");
+}
+
+/// Count system calls made after exec, or return -1 if tracing is not permitted
+static long countSyscalls(const char *prog) {
+  int master;
+  pid_t pid = spawn(prog, true, master);
+  int status;
+  errorIf(waitpid(pid, &status, 0) == -1, "waitpid");
+  if (!WIFSTOPPED(status)) {
+    close(master);
+    return -1; // Exited without stopping at exec, i.e. ptrace refused
+  }
+  errorIf(ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL) == -1, "ptrace");
+
+  // Each system call stops on entry and on exit, except exit_group() which never returns
+  long stops = 0;
+  int signal = 0;
+  while (true) {
+    errorIf(ptrace(PTRACE_SYSCALL, pid, nullptr, signal) == -1, "ptrace");
+    errorIf(waitpid(pid, &status, 0) == -1, "waitpid");
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      break;
+    }
+    signal = 0;
+    if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      stops++;
+    } else {
+      signal = WSTOPSIG(status); // Deliver signals unrelated to tracing
+    }
+  }
+  close(master);
+  checkExit(status);
+  return (stops + 1) / 2;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " PROGRAM [ITERATIONS [MAX_SYSCALLS]]" << std::endl
+              << "Fails if a run makes more than MAX_SYSCALLS system calls (0 for no limit)" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const char *prog = argv[1];
+  const int iterations = argc >= 3 ? atoi(argv[2]) : 1000;
+  errorIf(iterations <= 0 && (errno = EINVAL), "iterations");
+  const long max_syscalls = argc == 4 ? atol(argv[3]) : 0;
+  errorIf(max_syscalls < 0 && (errno = EINVAL), "max syscalls");
+
+  std::vector<double> times_us;
+  times_us.reserve(iterations);
+  for (int ii = 0; ii < iterations; ii++) {
+    auto start = std::chrono::steady_clock::now();
+    int master;
+    pid_t pid = spawn(prog, false, master);
+    int status;
+    errorIf(waitpid(pid, &status, 0) == -1, "waitpid");
+    auto stop = std::chrono::steady_clock::now();
+    close(master);
+    checkExit(status);
+    times_us.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+  }
+
+  std::sort(times_us.begin(), times_us.end());
+  double mean = 0;
+  for (const double &t : times_us) { mean += t / iterations; }
+  std::cout << "exec-to-exit (us) over " << iterations << " runs: "
+            << "min " << times_us.front()
+            << ", median " << times_us[iterations / 2]
+            << ", mean " << mean
+            << ", max " << times_us.back() << '\n';
+
+  long syscalls = countSyscalls(prog);
+  std::cout << "system calls after exec: ";
+  if (syscalls < 0) { std::cout << "unavailable (ptrace not permitted)"; }
+  else              { std::cout << syscalls; }
+  std::cout << std::endl;
+
+  if (max_syscalls > 0 && syscalls > max_syscalls) {
+    std::cerr << "More than " << max_syscalls << " system calls" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -35,7 +35,9 @@ int main() {
   bool keep_reading = true;
   while(keep_reading) {
     ReadKB::Key key_pressed = kb.read_key();
-    switch (dictionary[key_pressed]) {
+    // find() rather than operator[], which would insert (and allocate) for every unmapped key
+    auto command = dictionary.find(key_pressed);
+    switch (command != dictionary.end() ? command->second : NOT_DEFINED) {
       case EXIT_CODE : // Exit Condition
         keep_reading = false;
         break;
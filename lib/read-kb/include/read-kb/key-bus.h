@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#ifndef KEY_BUS_H
+#define KEY_BUS_H
+
+#include "read-kb.h"
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <string>
+
+/// Shared-memory ring buffer of decoded keys, written by one publisher and read
+/// lock-free by any number of local subscriber processes
+class KeyBus {
+ public:
+  /// Fixed-size binary key record
+  struct Record {
+    uint32_t key;       ///< ReadKB::Key value, including modifiers
+    uint32_t modifiers; ///< ReadKB::Key::modifiers() of the key
+    uint64_t timestamp; ///< CLOCK_REALTIME when published, in nanoseconds
+    uint64_t sequence;  ///< Position of the record in the stream, starting from 0
+  };
+
+  class Publisher;
+  class Subscriber;
+
+ private:
+  struct Header;
+  struct Slot;
+
+  static constexpr uint32_t kMagic   = 0x52424b42; // "RBKB"
+  static constexpr uint32_t kVersion = 2;
+  static constexpr int      kLivenessCheckMs = 250; ///< Interval at which waiting subscribers check the publisher
+
+  static size_t mapSize(const uint64_t &capacity);
+  static Slot*  slots(Header *header);
+};
+
+class KeyBus::Publisher {
+ public:
+  /// Create (or replace) the shared-memory object `name` (e.g. "/read-kb") holding `capacity` records.
+  /// Keys may include passwords, so only the owner may read them unless `mode` (e.g. 0640) allows others.
+  Publisher(const std::string &name, const uint64_t &capacity = 1024, const mode_t &mode = S_IRUSR | S_IWUSR);
+  /// Mark the bus closed, waking subscribers, and remove the shared-memory object
+  ~Publisher();
+
+  Publisher(const Publisher&) = delete;
+  Publisher& operator=(const Publisher&) = delete;
+
+  /// Append a key to the ring, overwriting the oldest record once the ring is full
+  void publish(const ReadKB::Key &key);
+
+ private:
+  std::string name_;
+  Header     *header_;
+  size_t      size_;
+};
+
+class KeyBus::Subscriber {
+ public:
+  enum class Status {
+    Ok,      ///< A record was read
+    Empty,   ///< No new records have been published
+    Overrun, ///< Records were overwritten before being read; see dropped()
+    Closed   ///< Every record was read and the publisher has closed the bus (or exited)
+  };
+
+  /// Attach to the shared-memory object `name`, starting after the most recently published record
+  explicit Subscriber(const std::string &name);
+  ~Subscriber();
+
+  Subscriber(const Subscriber&) = delete;
+  Subscriber& operator=(const Subscriber&) = delete;
+
+  /// Read the next record without blocking.
+  /// After an Overrun the subscriber resumes at the oldest record still available.
+  Status read(Record &record);
+  /// Read the next record, waiting up to `timeout_ms` (-1 waits forever) for one to be published
+  Status wait(Record &record, const int &timeout_ms = -1);
+
+  /// Total number of records skipped due to overruns
+  uint64_t dropped() const { return dropped_; }
+
+ private:
+  Header   *header_;
+  size_t    size_;
+  uint64_t  next_ = 0;
+  uint64_t  dropped_ = 0;
+};
+
+#endif // KEY_BUS_H
@@ -0,0 +1,82 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#ifndef KEY_TRACE_H
+#define KEY_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/// Process-wide, lock-free ring of binary trace records of the key reading path.
+/// Tracing is off until enabled at runtime with enable(), or by setting the
+/// environment variable READ_KB_TRACE to a file the ring is dumped to at exit.
+class KeyTrace {
+ public:
+  enum class Event : uint8_t {
+    PollWake = 1, ///< arg0: fd; arg1: poll() return value << 16 | revents
+    Read,         ///< arg0: fd; arg1: offset << 16 | bytes read; data: bytes from offset
+    Decode,       ///< arg0: key; arg1: length of the decoded sequence
+    Remap,        ///< arg0: key decoded; arg1: key returned
+    Coalesce      ///< arg0: key; arg1: repeat count
+  };
+
+  /// Fixed-size binary trace record
+  struct Record {
+    uint64_t timestamp;  ///< CLOCK_MONOTONIC in nanoseconds
+    uint32_t sequence;   ///< Position of the record in the trace (wraps)
+    Event    event;
+    uint8_t  length;     ///< Valid bytes in data
+    uint16_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint8_t  data[8];
+  };
+  static_assert(sizeof(Record) == 32, "Trace records are dumped as raw bytes");
+
+  static constexpr size_t   kCapacity = 4096; ///< Records kept (power of 2)
+  static constexpr uint32_t kMagic    = 0x54424b52; // "RKBT"
+  static constexpr uint32_t kVersion  = 1;
+
+  /// Header of a binary dump, followed by `count` records, oldest first
+  struct DumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+  };
+
+  static void enable(const bool &on) { enabled_.store(on, std::memory_order_relaxed); }
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+  /// Append a record if tracing is enabled; costs one relaxed load otherwise
+  static void trace(const Event &event, const uint32_t &arg0, const uint32_t &arg1,
+                    const uint8_t *data = nullptr, const size_t &length = 0) {
+    if (enabled_.load(std::memory_order_relaxed)) {
+      append(event, arg0, arg1, data, length);
+    }
+  }
+
+  /// Copy up to `max` of the most recent records into `out`, oldest first, returning the number copied
+  static size_t snapshot(Record *out, const size_t &max);
+  /// Write the ring to `fd` as a binary dump. Async-signal-safe, so it may be called from a signal handler.
+  static bool dump(const int &fd);
+  /// Write the ring to the file at `path` as a binary dump
+  static bool dump(const char *path);
+
+  /// Human-readable description of a record
+  friend std::ostream& operator<<(std::ostream& os, const Record& record);
+
+ private:
+  static inline std::atomic<bool> enabled_{false};
+
+  static void append(const Event &event, const uint32_t &arg0, const uint32_t &arg1,
+                     const uint8_t *data, size_t length);
+};
+
+#endif // KEY_TRACE_H
@@ -0,0 +1,165 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#ifndef READ_KB_CORO_H
+#define READ_KB_CORO_H
+
+#include "read-kb.h"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <optional>
+#include <vector>
+
+/// Hook through which a coroutine awaiting a key is suspended until its input is readable
+class KeyScheduler {
+ public:
+  /// A coroutine suspended on a file descriptor
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    bool timed_out = false;
+  };
+
+  virtual ~KeyScheduler() = default;
+
+  /// Resume `waiter->handle` once `fd` is readable, or set `waiter->timed_out` and resume it
+  /// after `timeout` (negative waits forever). Must not resume the handle before returning.
+  virtual void wait_readable(const int &fd, const std::chrono::milliseconds &timeout, Waiter *waiter) = 0;
+};
+
+/// Reference single-threaded scheduler multiplexing any number of waiting coroutines with epoll
+class EpollScheduler : public KeyScheduler {
+ public:
+  EpollScheduler();
+  ~EpollScheduler();
+
+  EpollScheduler(const EpollScheduler&) = delete;
+  EpollScheduler& operator=(const EpollScheduler&) = delete;
+
+  void wait_readable(const int &fd, const std::chrono::milliseconds &timeout, Waiter *waiter) override;
+
+  /// Resume coroutines as their input becomes readable or times out, until none are waiting
+  void run();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    Waiter           *waiter;
+    Clock::time_point deadline;
+    bool              polled;   ///< Registered with epoll (regular files cannot be, and are always readable)
+  };
+
+  int                   epfd_;
+  std::map<int, Entry>  waiting_;  ///< Keyed by file descriptor; one waiter per descriptor
+
+  void resume(const int &fd, const bool &timed_out, std::vector<Waiter*> &ready);
+};
+
+/// Coroutine interface to a ReadKB, e.g. `std::optional<ReadKB::Key> key = co_await kb.next_key();`
+class AsyncReadKB {
+ public:
+  class NextKey;
+
+  AsyncReadKB(ReadKB &kb, KeyScheduler &scheduler)
+    : kb_(kb), scheduler_(scheduler) {};
+
+  /// Awaitable resuming with the next key, or std::nullopt if none arrives within `timeout`.
+  /// Replies to queries read while waiting are delivered without resuming, and the wait goes on.
+  /// Waits for the rest of a split sequence, or for repeats within a coalescing window set on
+  /// the ReadKB, are also left to the scheduler, so they never block other coroutines.
+  NextKey next_key(const std::chrono::milliseconds &timeout = std::chrono::milliseconds(-1));
+
+ private:
+  ReadKB        &kb_;
+  KeyScheduler  &scheduler_;
+};
+
+class AsyncReadKB::NextKey {
+ public:
+  NextKey(ReadKB &kb, KeyScheduler &scheduler, const std::chrono::milliseconds &timeout)
+    : kb_(kb), scheduler_(scheduler), timeout_(timeout) {};
+
+  // Keys already complete in the buffer are returned without suspending
+  bool await_ready() { return ready_ = kb_.try_read_key(key_, count_, wait_ms_); }
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_   = handle;
+    deadline_ = Clock::now() + timeout_;
+    relay(*this);
+  }
+  std::optional<ReadKB::Key> await_resume() const {
+    if (!ready_) {
+      return std::nullopt;
+    }
+    return key_;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  /// Fire-and-forget coroutine waiting on behalf of the awaiting one
+  struct Relay {
+    struct promise_type {
+      Relay get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  /// Suspend until the input is readable, or the wait the ReadKB asked for (or else the rest of
+  /// the timeout) passes
+  struct Readable {
+    NextKey &next;
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+      next.waiter_.handle = handle;
+      std::chrono::milliseconds timeout = next.timeout_;
+      if (timeout.count() >= 0) {
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(next.deadline_ - Clock::now());
+        timeout = timeout.count() > 0 ? timeout : std::chrono::milliseconds(0);
+      }
+      if (next.wait_ms_ >= 0 && (timeout.count() < 0 || next.wait_ms_ < timeout.count())) {
+        timeout = std::chrono::milliseconds(next.wait_ms_);
+      }
+      next.scheduler_.wait_readable(next.kb_.fd(), timeout, &next.waiter_);
+    }
+    void await_resume() const {}
+  };
+
+  /// Resume the awaiting coroutine once a key is complete, reading input as it becomes readable.
+  /// Input holding only replies to queries, or only part of a key, leaves no key, so the wait
+  /// starts again.
+  static Relay relay(NextKey &next) {
+    do {
+      co_await Readable{next};
+      next.kb_.pump(0);
+      next.ready_ = next.kb_.try_read_key(next.key_, next.count_, next.wait_ms_);
+    } while (!next.ready_ && (next.timeout_.count() < 0 || Clock::now() < next.deadline_));
+    next.handle_.resume(); // May destroy `next`
+  }
+
+  ReadKB                    &kb_;
+  KeyScheduler              &scheduler_;
+  std::chrono::milliseconds  timeout_;
+  Clock::time_point          deadline_;
+  std::coroutine_handle<>    handle_;
+  KeyScheduler::Waiter       waiter_;
+  bool                       ready_ = false;  ///< A key was read into key_
+  ReadKB::Key                key_;
+  uint                       count_ = 0;
+  int                        wait_ms_ = -1;   ///< How long the ReadKB asked to wait for more input
+};
+
+inline AsyncReadKB::NextKey AsyncReadKB::next_key(const std::chrono::milliseconds &timeout) {
+  return NextKey(kb_, scheduler_, timeout);
+}
+
+#endif // READ_KB_CORO_H
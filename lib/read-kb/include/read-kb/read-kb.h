@@ -9,15 +9,16 @@
 #define READ_KB_H
 
 #include <poll.h>
+#include <termios.h>
+#include <unistd.h>
 
-#include <cstdio>
+#include <bitset>
+#include <functional>
+#include <future>
 #include <ostream>
 #include <string>
 #include <utility>
 
-// use `tail -f "/tmp/read-kb-debug-log.txt"` from a terminal to see debug messages
-#define DEBUG_LIB_READ_KB 0
-
 class ReadKB {
  public:
   enum class InputMode {
@@ -26,6 +27,42 @@ class ReadKB {
     File
   };
 
+  /// Groups of keys that may be coalesced when auto-repeat is detected
+  enum class KeyClass {
+    Any,        ///< Every key except error codes
+    Navigation, ///< Arrows, Home, End, PageUp, and PageDown (with any modifiers)
+    Editing     ///< Backspace and Delete (with any modifiers)
+  };
+
+  /// Queries the terminal answers with a control sequence on its input
+  enum class Query {
+    CursorPosition,         ///< Cursor position report, ESC [ row ; col R
+    DeviceStatus,           ///< Device status report, ESC [ 0 n (or 3 n on malfunction)
+    PrimaryAttributes,      ///< Primary device attributes, ESC [ ? attr ; ... c
+    SecondaryAttributes,    ///< Secondary device attributes, ESC [ > type ; version ; rom c
+    ExtendedCursorPosition  ///< DEC extended cursor position report, ESC [ ? row ; col (; page) R, never mistaken for a key
+  };
+
+  static constexpr ssize_t kBufferSize       = 4096; ///< Room for typed-ahead (or pasted) keys and replies after them
+  static constexpr size_t kMaxReplyParams    = 16; ///< Numeric parameters kept from a reply
+  static constexpr size_t kMaxPendingQueries = 8;
+  static constexpr int    kReplyWaitMs       = 100; ///< Wait for the rest of a reply split across reads
+
+  /// Answer to a Query, holding the numeric parameters of the reply in order
+  /// (e.g. row and column for Query::CursorPosition)
+  struct Reply {
+    enum class Status {
+      Ok,
+      Cancelled, ///< No reply came before cancelQueries() or destruction
+      Failed     ///< The query could not be sent, or too many were pending
+    };
+    Query   query;
+    Status  status;
+    size_t  count;
+    uint    params[kMaxReplyParams];
+  };
+  typedef std::function<void(const Reply&)> ReplyCallback;
+
   ReadKB();
   ~ReadKB();
 
@@ -34,12 +71,52 @@ class ReadKB {
   /// Modifier keys that can be combined via & operator with a ReadKB::Key
   struct Mod;
 
-  Key read_key() const;
+  /// Read a key. Once constructed, reading keys never allocates (nor does decode() or Key::format()).
+  Key read_key();
+  /// Read a key and report in `count` how many identical keys were coalesced into it
+  Key read_key(uint &count);
+  /// Read a key as read_key(count) would, but without waiting for input: if no key is complete from the
+  /// input already read, return false and set `wait_ms` to how long to wait (-1 for ever) for more input,
+  /// to be read with pump() before trying again (once it arrives, or the wait is over), e.g. from an event loop
+  bool try_read_key(Key &key, uint &count, int &wait_ms);
   std::string read_line() const { return "Not yet implemented"; };
   std::string read_file() const { return "Not yet implemented"; };
 
   void setInput(const int &fd, const InputMode &mode);
 
+  /// Decode the first key in `buf` as read_key() would, returning the number of bytes it spans
+  static ssize_t decode(const u_char *buf, const ssize_t &len, Key &key);
+  /// First position at or after `pos` where decode() can start without splitting a key sequence,
+  /// or `len` if there is none. Decoding chunks split at such positions gives the same keys as
+  /// decoding the whole buffer.
+  static ssize_t syncPoint(const u_char *buf, const ssize_t &len, const ssize_t &pos);
+  /// File descriptor keys are read from
+  int fd() const { return pfd_.fd; }
+  /// Whether input is already buffered, so read_key() will not wait for the file descriptor
+  bool buffered() const { return buf_begin_ != buf_end_; }
+  /// Whether the last read_key() returned Key::ERROR because the input ended, rather than for an unknown sequence
+  bool eof() const { return eof_; }
+  /// Send a query to the output and call `callback` with the reply once it is read, from
+  /// within read_key() or pump(). Replies are removed from the input, so keys typed around
+  /// them are still returned in order. Returns false (after calling `callback`) on failure.
+  bool query(const Query &query, ReplyCallback callback);
+  /// Send a query to the output, returning a future for the reply
+  std::future<Reply> query(const Query &query);
+  /// Answer every pending query with Reply::Status::Cancelled, e.g. when a terminal does not reply
+  void cancelQueries();
+  /// Read available input, waiting up to `timeout_ms` (-1 for ever), to deliver replies without
+  /// taking keys, which stay buffered for read_key(). Returns false if nothing was read, which
+  /// includes when kBufferSize bytes of keys are already buffered.
+  bool pump(const int &timeout_ms) { return fillBuffer(timeout_ms); }
+  /// File descriptor queries are written to (standard output by default)
+  void setOutput(const int &fd) { output_fd_ = fd; }
+  /// Opt in to returning runs of identical keys as one key with a repeat count.
+  /// Keys already buffered are always coalesced; a positive `window_ms` also waits
+  /// that long after the first key of a run for further repeats to arrive.
+  void setCoalescing(const bool &enable,
+                     const int &window_ms = 0,
+                     const KeyClass &key_class = KeyClass::Any);
+
  private:
   enum class BitmaskSet : uint { /// @todo Convert class to enum of {5, 6, 7, 8, 9, 16}
     // When mask is applied with &, the corresponding bits will be set
@@ -72,16 +149,52 @@ class ReadKB {
     return mod  &= m2;
   }
 
+  // Longest sequence decoded as one key; the longest ANSI sequence (that I know of) is of the form e[nn;n~
+  static constexpr ssize_t kMaxSequenceLength = 64;
+
   InputMode mode_ = InputMode::Char;
-  struct pollfd *pfds;
-  #if DEBUG_LIB_READ_KB == 1
-    FILE* g_pDebugLogFile;
-  #endif
+  struct pollfd   pfd_ = {-1, POLLIN, 0}; ///< Request poll() to scan for data available to read (POLLIN)
+  struct termios  saved_term_;            ///< Terminal attributes to restore when input is switched or closed
+  bool            restore_term_ = false;
+  u_char    buf_[kBufferSize];  ///< Bytes read from the input but not yet returned as keys
+  ssize_t   buf_begin_ = 0;
+  ssize_t   buf_end_   = 0;
+  ssize_t   buf_routed_ = 0;        ///< Sequences before this were already checked for replies
+  std::bitset<kBufferSize> buf_lone_esc_; ///< Esc keys left alone by removing the reply that followed them
+  bool      eof_ = false;
+  bool      at_end_ = false;            ///< The last read found the end of input (or an error), and no key was returned since
+  bool      split_ = false;             ///< Waiting for the rest of a sequence split by a short read
+  struct timespec split_start_;
+  uint      run_key_ = 0;               ///< Key whose repeats are being coalesced
+  uint      run_count_ = 0;             ///< Repeats of run_key_ so far, or 0 if no run is in progress
+  struct timespec run_start_;
+  bool      coalesce_ = false;
+  int       coalesce_window_ms_ = 0;
+  KeyClass  coalesce_class_ = KeyClass::Any;
+  int       output_fd_ = STDOUT_FILENO;
+
+  struct PendingQuery {
+    Query         query;
+    ReplyCallback callback;
+  };
+  PendingQuery pending_[kMaxPendingQueries];  ///< Queries awaiting a reply, oldest first
+  size_t       num_pending_ = 0;
 
   void      resetTerminal(const int fd);
-  Key       categorizeBuffer(const u_char *buf, const ssize_t len) const;
-  Key       categorizeFunction(const u_char *buf, const ssize_t len) const;
-  Modifier  categorizeMod(const u_char c) const;
+  void      restoreTerminal();
+  bool      fillBuffer(const int timeout_ms);
+  void      routeReplies();
+  ssize_t   bufferedLength(const ssize_t pos) const;
+  bool      mayBeReply() const;
+  bool      routeReply(const u_char *buf, const ssize_t len);
+  void      answerQuery(const size_t &index, Reply &reply);
+  ssize_t   nextSequence(int &wait_ms);
+  static Key remapKey(Key key_pressed);
+  bool      isCoalescable(const Key &key) const;
+  static ssize_t sequenceLength(const u_char *buf, const ssize_t len);
+  static Key       categorizeBuffer(const u_char *buf, const ssize_t len);
+  static Key       categorizeFunction(const u_char *buf, const ssize_t len);
+  static Modifier  categorizeMod(const u_char c);
 };
 
 
@@ -215,6 +328,42 @@ class ReadKB::Key {
     return key;
   }
 
+  // Modifier flags returned by modifiers(), in the order of the terminal encoding (1 + flags)
+  enum ModifierBits: uint {
+    ShftBit = 1<<0,
+    AltBit  = 1<<1,
+    CtrlBit = 1<<2
+  };
+
+  /// Modifier keys combined with the key, as a combination of ModifierBits
+  constexpr uint modifiers() const {
+    uint bits = 0;
+    if (mkey & static_cast<uint>(BitmaskSet::Control))   { bits |= CtrlBit; }
+    if (mkey & static_cast<uint>(BitmaskSet::Alternate)) { bits |= AltBit; }
+    if (mkey >= KeyValue::ERROR) { return bits; } // Error codes carry Ctrl and Alt only
+    if (((mkey & static_cast<uint>(BitmaskSet::Event)) && !(mkey & static_cast<uint>(BitmaskSet::Lowercase))) ||
+        (mkey & 0xFF) == 0) { // Shft-Space
+      bits |= ShftBit;
+    }
+    return bits;
+  }
+
+  /// The key with all modifier keys removed
+  constexpr Key base() const {
+    uint key = mkey & ~(static_cast<uint>(BitmaskSet::Control) | static_cast<uint>(BitmaskSet::Alternate));
+    if (key >= KeyValue::ERROR) { return Key(key); }
+    if (key & static_cast<uint>(BitmaskSet::Event)) { key |= static_cast<uint>(BitmaskSet::Lowercase); }
+    if (key == 0) { key = KeyValue::Space; }
+    return Key(key);
+  }
+
+  /// Longest display name, including the terminating null character
+  static constexpr size_t kMaxNameLength = 32;
+
+  /// Write the display name of the key to `buf` as a null-terminated string of at most `size` chars,
+  /// without allocating. Returns the length of the name.
+  size_t format(char *buf, const size_t &size) const;
+
   /// Stream insertion operator
   friend std::ostream& operator<<(std::ostream& os, const Key& kb);
 
@@ -0,0 +1,19 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#ifndef ERROR_IF_H
+#define ERROR_IF_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Define error-handling function
+#define errorIf(cond, msg) do { if( cond ) { \
+                                  perror(msg); exit(EXIT_FAILURE); \
+                              }} while (0)
+
+#endif // ERROR_IF_H
@@ -0,0 +1,227 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "error-if.h"
+#include "key-bus.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+
+// Layout of the shared-memory object: a header followed by `capacity` slots.
+// The publisher is the only writer. Each slot is guarded by a sequence lock so
+// subscribers can copy records without locks and detect when the publisher
+// overwrote a slot while it was being read.
+struct KeyBus::Header {
+  std::atomic<uint32_t> magic;    ///< Written last, once the header is valid
+  uint32_t              version;
+  uint64_t              capacity;
+  std::atomic<uint64_t> head;     ///< Sequence number of the next record to be published
+  std::atomic<uint32_t> notify;   ///< Futex word incremented after every publish, and on close
+  std::atomic<uint32_t> closed;   ///< Set once the publisher will publish no more
+  int32_t               publisher; ///< Process ID of the publisher, to detect one that exited without closing
+};
+
+struct alignas(32) KeyBus::Slot {
+  std::atomic<uint64_t> stamp;    ///< Sequence number + 1 of the record held, 0 if empty, or kWriting
+  std::atomic<uint32_t> key;
+  std::atomic<uint32_t> modifiers;
+  std::atomic<uint64_t> timestamp;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared-memory atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared-memory atomics must be lock free");
+
+namespace {
+
+constexpr uint64_t kWriting = UINT64_MAX;
+
+int futex(std::atomic<uint32_t> *addr, const int op, const uint32_t val, const struct timespec *timeout) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val, timeout, nullptr, 0);
+}
+
+} // namespace
+
+size_t KeyBus::mapSize(const uint64_t &capacity) {
+  // Header padded to the alignment of the slots that follow it
+  constexpr size_t offset = (sizeof(Header) + alignof(Slot) - 1) / alignof(Slot) * alignof(Slot);
+  return offset + capacity * sizeof(Slot);
+}
+
+KeyBus::Slot* KeyBus::slots(Header *header) {
+  return reinterpret_cast<Slot*>(reinterpret_cast<char*>(header) + mapSize(0));
+}
+
+KeyBus::Publisher::Publisher(const std::string &name, const uint64_t &capacity, const mode_t &mode)
+  : name_(name), size_(mapSize(capacity)) {
+  errorIf(capacity == 0 && (errno = EINVAL), "key bus capacity");
+
+  // Replace any stale object so existing subscribers keep their (now detached) mapping
+  shm_unlink(name_.c_str());
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  errorIf(fd == -1, "shm_open");
+  // Set the mode explicitly, as shm_open() applies the umask
+  errorIf(fchmod(fd, mode) == -1, "fchmod");
+  errorIf(ftruncate(fd, size_) == -1, "ftruncate");
+  void *addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  errorIf(addr == MAP_FAILED, "mmap");
+  close(fd);
+
+  // Object is zero-filled by ftruncate, i.e. all slots empty
+  header_ = new (addr) Header();
+  for (uint64_t ii = 0; ii < capacity; ii++) {
+    new (&slots(header_)[ii]) Slot();
+  }
+  header_->version   = kVersion;
+  header_->capacity  = capacity;
+  header_->publisher = getpid();
+  header_->magic.store(kMagic, std::memory_order_release);
+}
+
+KeyBus::Publisher::~Publisher() {
+  header_->closed.store(1, std::memory_order_release);
+  header_->notify.fetch_add(1, std::memory_order_release);
+  futex(&header_->notify, FUTEX_WAKE, INT_MAX, nullptr);
+  munmap(header_, size_);
+  shm_unlink(name_.c_str());
+}
+
+void KeyBus::Publisher::publish(const ReadKB::Key &key) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  uint64_t seq = header_->head.load(std::memory_order_relaxed);
+  Slot &slot = slots(header_)[seq % header_->capacity];
+
+  slot.stamp.store(kWriting, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.key.store(key, std::memory_order_relaxed);
+  slot.modifiers.store(key.modifiers(), std::memory_order_relaxed);
+  slot.timestamp.store(now.tv_sec * 1000000000ull + now.tv_nsec, std::memory_order_relaxed);
+  slot.stamp.store(seq + 1, std::memory_order_release);
+
+  header_->head.store(seq + 1, std::memory_order_release);
+  header_->notify.fetch_add(1, std::memory_order_release);
+  futex(&header_->notify, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+KeyBus::Subscriber::Subscriber(const std::string &name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  errorIf(fd == -1, "shm_open");
+  struct stat st;
+  errorIf(fstat(fd, &st) == -1, "fstat");
+  size_ = st.st_size;
+  errorIf(size_ < mapSize(0) && (errno = EPROTO), "key bus header");
+  void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  errorIf(addr == MAP_FAILED, "mmap");
+  close(fd);
+
+  header_ = static_cast<Header*>(addr);
+  errorIf(header_->magic.load(std::memory_order_acquire) != kMagic && (errno = EPROTO), "key bus magic");
+  errorIf(header_->version != kVersion && (errno = EPROTO), "key bus version");
+  errorIf(size_ < mapSize(header_->capacity) && (errno = EPROTO), "key bus size");
+
+  next_ = header_->head.load(std::memory_order_acquire);
+}
+
+KeyBus::Subscriber::~Subscriber() {
+  munmap(header_, size_);
+}
+
+KeyBus::Subscriber::Status KeyBus::Subscriber::read(Record &record) {
+  // Closed after the last publish, so every record is visible once closed is
+  bool closed = header_->closed.load(std::memory_order_acquire);
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  if (next_ >= head) {
+    return closed ? Status::Closed : Status::Empty;
+  }
+
+  // Records older than one lap of the ring have already been overwritten
+  const uint64_t capacity = header_->capacity;
+  if (head - next_ > capacity) {
+    dropped_ += head - capacity - next_;
+    next_ = head - capacity;
+    return Status::Overrun;
+  }
+
+  const Slot &slot = slots(header_)[next_ % capacity];
+  uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+  record.key        = slot.key.load(std::memory_order_relaxed);
+  record.modifiers  = slot.modifiers.load(std::memory_order_relaxed);
+  record.timestamp  = slot.timestamp.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (stamp != next_ + 1 || slot.stamp.load(std::memory_order_relaxed) != stamp) {
+    // Publisher lapped this subscriber while the record was being copied
+    head = header_->head.load(std::memory_order_acquire);
+    uint64_t oldest = head > capacity ? head - capacity : 0;
+    oldest = oldest > next_ ? oldest : next_ + 1;
+    dropped_ += oldest - next_;
+    next_ = oldest;
+    return Status::Overrun;
+  }
+
+  record.sequence = next_++;
+  return Status::Ok;
+}
+
+KeyBus::Subscriber::Status KeyBus::Subscriber::wait(Record &record, const int &timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec  += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000l;
+  if (deadline.tv_nsec >= 1000000000l) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000l;
+  }
+
+  while (true) {
+    // Sample the futex word before checking, so a publish in between is not missed
+    uint32_t notify = header_->notify.load(std::memory_order_acquire);
+    Status status = read(record);
+    if (status != Status::Empty) {
+      return status;
+    }
+
+    // A publisher that exited without closing never wakes us, so check on it periodically
+    if (kill(header_->publisher, 0) == -1 && errno == ESRCH) {
+      status = read(record);
+      return status == Status::Empty ? Status::Closed : status;
+    }
+
+    struct timespec remaining = {kLivenessCheckMs / 1000, (kLivenessCheckMs % 1000) * 1000000l};
+    if (timeout_ms >= 0) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining.tv_sec  = deadline.tv_sec - now.tv_sec;
+      remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+      if (remaining.tv_nsec < 0) {
+        remaining.tv_sec--;
+        remaining.tv_nsec += 1000000000l;
+      }
+      if (remaining.tv_sec < 0) {
+        return Status::Empty;
+      }
+      if (remaining.tv_sec * 1000 + remaining.tv_nsec / 1000000 > kLivenessCheckMs) {
+        remaining = {kLivenessCheckMs / 1000, (kLivenessCheckMs % 1000) * 1000000l};
+      }
+    }
+    int rc = futex(&header_->notify, FUTEX_WAIT, notify, &remaining);
+    errorIf(rc == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT, "futex");
+  }
+}
@@ -0,0 +1,193 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "key-trace.h"
+#include "read-kb.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+
+static_assert((KeyTrace::kCapacity & (KeyTrace::kCapacity - 1)) == 0, "Capacity must be a power of 2");
+
+namespace {
+
+constexpr uint64_t kWriting = UINT64_MAX;
+constexpr size_t   kWords   = sizeof(KeyTrace::Record) / sizeof(uint64_t);
+
+// Each slot is guarded by a sequence lock, so writers on any thread never wait
+// and readers skip records that were overwritten while being copied.
+struct Slot {
+  std::atomic<uint64_t> stamp;    ///< Index + 1 of the record held, 0 if empty, or kWriting
+  std::atomic<uint64_t> words[kWords];
+};
+
+// Zero-initialized, i.e. all slots empty
+Slot g_ring[KeyTrace::kCapacity];
+std::atomic<uint64_t> g_head{0}; ///< Index of the next record to be written
+
+const char *g_dump_path = nullptr;
+
+void dumpAtExit() {
+  KeyTrace::dump(g_dump_path);
+}
+
+// Enable tracing from the environment, without rebuilding the application
+struct EnvironmentInit {
+  EnvironmentInit() {
+    g_dump_path = getenv("READ_KB_TRACE");
+    if (g_dump_path != nullptr && *g_dump_path != '\0') {
+      KeyTrace::enable(true);
+      atexit(dumpAtExit);
+    }
+  }
+} g_environment_init;
+
+} // namespace
+
+void KeyTrace::append(const Event &event, const uint32_t &arg0, const uint32_t &arg1,
+                      const uint8_t *data, size_t length) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t index = g_head.fetch_add(1, std::memory_order_relaxed);
+
+  Record record = {};
+  record.timestamp = now.tv_sec * 1000000000ull + now.tv_nsec;
+  record.sequence  = static_cast<uint32_t>(index);
+  record.event     = event;
+  record.length    = length < sizeof(record.data) ? length : sizeof(record.data);
+  record.arg0      = arg0;
+  record.arg1      = arg1;
+  if (data != nullptr) {
+    memcpy(record.data, data, record.length);
+  }
+  uint64_t words[kWords];
+  memcpy(words, &record, sizeof(record));
+
+  Slot &slot = g_ring[index & (kCapacity - 1)];
+  slot.stamp.store(kWriting, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t ii = 0; ii < kWords; ii++) {
+    slot.words[ii].store(words[ii], std::memory_order_relaxed);
+  }
+  slot.stamp.store(index + 1, std::memory_order_release);
+}
+
+/// Copy the record with the given index, returning false if it was overwritten or is being written
+static bool readSlot(const uint64_t &index, KeyTrace::Record &record) {
+  const Slot &slot = g_ring[index & (KeyTrace::kCapacity - 1)];
+  uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+  uint64_t words[kWords];
+  for (size_t ii = 0; ii < kWords; ii++) {
+    words[ii] = slot.words[ii].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (stamp != index + 1 || slot.stamp.load(std::memory_order_relaxed) != stamp) {
+    return false;
+  }
+  memcpy(&record, words, sizeof(record));
+  return true;
+}
+
+size_t KeyTrace::snapshot(Record *out, const size_t &max) {
+  uint64_t head  = g_head.load(std::memory_order_acquire);
+  uint64_t count = head < kCapacity ? head : kCapacity;
+  count = count < max ? count : max;
+  size_t copied = 0;
+  for (uint64_t index = head - count; index < head; index++) {
+    if (readSlot(index, out[copied])) {
+      copied++;
+    }
+  }
+  return copied;
+}
+
+bool KeyTrace::dump(const int &fd) {
+  // Only stack buffers and write(), so this is safe in a signal handler
+  uint64_t head  = g_head.load(std::memory_order_acquire);
+  uint64_t count = head < kCapacity ? head : kCapacity;
+  DumpHeader header = {kMagic, kVersion, sizeof(Record), static_cast<uint32_t>(count)};
+  if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+    return false;
+  }
+
+  Record batch[64];
+  size_t batched = 0;
+  for (uint64_t index = head - count; index < head; index++) {
+    if (!readSlot(index, batch[batched])) {
+      batch[batched] = Record(); // Overwritten while dumping; decoded as invalid
+    }
+    if (++batched == sizeof(batch) / sizeof(batch[0]) || index + 1 == head) {
+      ssize_t bytes = batched * sizeof(Record);
+      if (write(fd, batch, bytes) != bytes) {
+        return false;
+      }
+      batched = 0;
+    }
+  }
+  return true;
+}
+
+bool KeyTrace::dump(const char *path) {
+  // Traces hold every key typed, including passwords, so only the owner may read them
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    return false;
+  }
+  // Also restrict an existing file, but leave devices and pipes (e.g. /dev/stderr) alone
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && (info.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    fchmod(fd, S_IRUSR | S_IWUSR);
+  }
+  bool ok = dump(fd);
+  return close(fd) == 0 && ok;
+}
+
+std::ostream& operator<<(std::ostream& os, const KeyTrace::Record& record) {
+  os << std::setw(10) << record.sequence << "  "
+     << record.timestamp / 1000000000ull << "."
+     << std::setfill('0') << std::setw(9) << record.timestamp % 1000000000ull << std::setfill(' ') << "  ";
+  switch (record.event) {
+    case KeyTrace::Event::PollWake :
+      os << "poll     fd=" << record.arg0 << " ready=" << static_cast<int16_t>(record.arg1 >> 16) << " revents=";
+      if (record.arg1 & POLLIN)   { os << "POLLIN "; }
+      if (record.arg1 & POLLHUP)  { os << "POLLHUP "; }
+      if (record.arg1 & POLLERR)  { os << "POLLERR "; }
+      if (record.arg1 & POLLNVAL) { os << "POLLNVAL "; }
+      break;
+    case KeyTrace::Event::Read :
+      os << "read     fd=" << record.arg0 << " bytes=" << (record.arg1 & 0xFFFF)
+         << " +" << (record.arg1 >> 16) << ":";
+      for (uint8_t ii = 0; ii < record.length; ii++) {
+        // Show control codes in caret notation, like the terminal
+        u_char c = record.data[ii];
+        if (c < ' ')        { os << " ^" << static_cast<char>(c + 64); }
+        else if (c == 127)  { os << " ^?"; }
+        else if (c > 127)   { os << " \\x" << std::hex << static_cast<int>(c) << std::dec; }
+        else                { os << " " << static_cast<char>(c); }
+      }
+      break;
+    case KeyTrace::Event::Decode :
+      os << "decode   " << ReadKB::Key(record.arg0) << " (" << record.arg1 << " bytes)";
+      break;
+    case KeyTrace::Event::Remap :
+      os << "remap    " << ReadKB::Key(record.arg0) << " -> " << ReadKB::Key(record.arg1);
+      break;
+    case KeyTrace::Event::Coalesce :
+      os << "coalesce " << ReadKB::Key(record.arg0) << " x" << record.arg1;
+      break;
+    default :
+      os << "invalid";
+  }
+  return os;
+}
@@ -0,0 +1,109 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "error-if.h"
+#include "read-kb-coro.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+#define MAX_EVENTS 16 // Events collected per call to epoll_wait()
+
+EpollScheduler::EpollScheduler() {
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  errorIf(epfd_ == -1, "epoll_create1");
+}
+
+EpollScheduler::~EpollScheduler() {
+  close(epfd_);
+}
+
+void EpollScheduler::wait_readable(const int &fd, const std::chrono::milliseconds &timeout, Waiter *waiter) {
+  errorIf(waiting_.count(fd) != 0 && (errno = EBUSY), "wait_readable");
+
+  struct epoll_event ev = {};
+  ev.events  = EPOLLIN;
+  ev.data.fd = fd;
+  bool polled = true;
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    // Regular files do not support epoll, but never block either
+    errorIf(errno != EPERM, "epoll_ctl");
+    polled = false;
+  }
+
+  waiter->timed_out = false;
+  waiting_[fd] = Entry{waiter,
+                       timeout.count() < 0 ? Clock::time_point::max() : Clock::now() + timeout,
+                       polled};
+}
+
+void EpollScheduler::resume(const int &fd, const bool &timed_out, std::vector<Waiter*> &ready) {
+  auto it = waiting_.find(fd);
+  if (it == waiting_.end()) {
+    return;
+  }
+  if (it->second.polled) {
+    errorIf(epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr) == -1, "epoll_ctl");
+  }
+  it->second.waiter->timed_out = timed_out;
+  ready.push_back(it->second.waiter);
+  waiting_.erase(it);
+}
+
+void EpollScheduler::run() {
+  std::vector<Waiter*> ready;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (!waiting_.empty()) {
+    // Sleep until the nearest deadline, or not at all if a waiter is on an always-readable file
+    Clock::time_point now = Clock::now();
+    Clock::time_point next = Clock::time_point::max();
+    bool immediate = false;
+    for (const auto &entry : waiting_) {
+      immediate |= !entry.second.polled;
+      next = entry.second.deadline < next ? entry.second.deadline : next;
+    }
+    int timeout_ms = -1;
+    if (immediate || next <= now) {
+      timeout_ms = 0;
+    } else if (next != Clock::time_point::max()) {
+      // Round up so the deadline has passed on wakeup
+      timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+    }
+
+    int num_ready = epoll_wait(epfd_, events, MAX_EVENTS, timeout_ms);
+    errorIf(num_ready == -1 && errno != EINTR, "epoll_wait");
+    for (int ii = 0; ii < num_ready; ii++) {
+      resume(events[ii].data.fd, false, ready);
+    }
+
+    // Unpolled files are ready, and anything left past its deadline has timed out
+    now = Clock::now();
+    std::vector<std::pair<int, bool>> expired;
+    for (const auto &entry : waiting_) {
+      if (!entry.second.polled) {
+        expired.emplace_back(entry.first, false);
+      } else if (entry.second.deadline <= now) {
+        expired.emplace_back(entry.first, true);
+      }
+    }
+    for (const auto &fd_timed_out : expired) {
+      resume(fd_timed_out.first, fd_timed_out.second, ready);
+    }
+
+    // Resume only after bookkeeping, as resumed coroutines may wait again
+    for (Waiter *waiter : ready) {
+      waiter->handle.resume();
+    }
+    ready.clear();
+  }
+}
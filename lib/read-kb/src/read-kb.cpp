@@ -5,6 +5,8 @@
  * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
  */
 
+#include "error-if.h"
+#include "key-trace.h"
 #include "read-kb.h"
 
 #include <termios.h>
@@ -14,98 +16,338 @@
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
-#include <fstream>
-#include <iostream>
+#include <cstring>
+#include <ctime>
+#include <memory>
 #include <string>
 
-#if DEBUG_LIB_READ_KB == 0
-#   define printlog(...)   do {} while (0)
-#else
-#   define printlog(...)   do { fprintf(g_pDebugLogFile, __VA_ARGS__); \
-                                fseek(g_pDebugLogFile, 0, SEEK_END); \
-                              } while (0)
-#endif
-
-// Define error-handling function
-#define errorIf(cond, msg) do { if( cond ) { \
-                                  perror(msg); exit(EXIT_FAILURE); \
-                              }} while (0)
-
 #define STDIN_FD 0 // Standard input file descriptor
-#define BUFF_SIZE_CHARS 8 // Unicode less than 5 bytes and longest ANSI sequence (that I know of) is of the form e[nn;n~
-
-ReadKB::ReadKB() {
-  // Initialize debugging log file
-  #if DEBUG_LIB_READ_KB == 1
-    g_pDebugLogFile = fopen ("/tmp/read-kb-debug-log.txt", "w");
-  #endif
 
-  // Allocate memory for file descriptor for the poll command
-  pfds = static_cast<pollfd*>(calloc(1, sizeof(struct pollfd)));
-  errorIf(pfds == NULL, "malloc");
+/// Milliseconds since `start` on the monotonic clock
+static int elapsedMs(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+}
 
+ReadKB::ReadKB() {
   // Get single characters and assign file descriptor to poll structure
   setInput(STDIN_FD, InputMode::Char);
-
-  // Request poll() to scan file descriptor for data available to read (POLLIN signal)
-  pfds->events = POLLIN;
 }
 
 ReadKB::~ReadKB() {
-  resetTerminal(STDIN_FD);
+  cancelQueries();
+  restoreTerminal();
 }
 
-ReadKB::Key ReadKB::read_key() const {
-  int num_ready;
+ReadKB::Key ReadKB::read_key() {
+  uint count;
+  return read_key(count);
+}
+
+ReadKB::Key ReadKB::read_key(uint &count) {
   Key key_pressed;
+  int wait_ms;
+  while (!try_read_key(key_pressed, count, wait_ms)) {
+    fillBuffer(wait_ms);
+  }
+  return key_pressed;
+}
 
-  printlog("Polling pipe for signal or data... ");
-  num_ready = poll(pfds, 1, -1);
-  errorIf(num_ready == -1, "poll");
-  printlog("Pipes ready: %d\n", num_ready);
-
-  // Deal with array returned by poll()
-  {
-    // Read from pipe one buffer-length at a time
-    u_char buf[BUFF_SIZE_CHARS];
-
-    if (pfds->revents != 0) {
-
-      // Log signals (events) found by poll
-      printlog("  fd=%d; events: %s%s%s%s\n", pfds->fd,
-          (pfds->revents & POLLIN)   ? "\033[32mPOLLIN\033[0m "   : "",
-          (pfds->revents & POLLHUP)  ? "\033[33mPOLLHUP\033[0m "  : "",
-          (pfds->revents & POLLERR)  ? "\033[31mPOLLERR\033[0m "  : "",
-          (pfds->revents & POLLNVAL) ? "\033[31mPOLLNVAL\033[0m " : "");
-
-      if (pfds->revents & POLLIN) {
-        // Read from the pipe if there is data available (POLLIN)
-
-        ssize_t s = read(pfds->fd, buf, sizeof(buf));
-        errorIf(s == -1, "read");
-        errorIf(s + 1 > BUFF_SIZE_CHARS && (errno = ENOBUFS), "read");
-        printlog("    read %zd bytes: \033[1m", s);
-        #if DEBUG_LIB_READ_KB
-        for (int ii = 0; ii < s; ii++) {
-          char c = buf[ii];
-          char delimL = (c <= ' ' ? '[' : ' ');
-          char delimR = (c <= ' ' ? ']' : ' ');
-          c = (c < ' ' ? c + 64 : c ); // C0 Control Codes
-          c = (c == 127 ? 128 : c );   // DEL character
-          printlog("%c%c%c", delimL, c, delimR);
-        }
-        #endif
-        printlog("\033[0m\n");
+bool ReadKB::try_read_key(Key &key, uint &count, int &wait_ms) {
+  eof_ = false;
+  if (run_count_ == 0) {
+    ssize_t len = nextSequence(wait_ms);
+    if (len == 0) {
+      // Nothing buffered (or only replies to queries were read), or the rest of a sequence may still come
+      if (buf_begin_ == buf_end_ && at_end_) {
+        eof_    = true;
+        at_end_ = false; // Input may still be appended, e.g. to a file
+        key     = Key::ERROR;
+        count   = 1;
+        return true;
+      }
+      return false;
+    }
+    Key key_pressed = categorizeBuffer(&buf_[buf_begin_], len);
+    buf_begin_ += len;
+    KeyTrace::trace(KeyTrace::Event::Decode, key_pressed, len);
+    key = remapKey(key_pressed);
+    count = 1;
+    if (!coalesce_ || !isCoalescable(key)) {
+      at_end_ = false;
+      return true;
+    }
+    run_key_   = key;
+    run_count_ = 1;
+    clock_gettime(CLOCK_MONOTONIC, &run_start_);
+  }
+
+  // Absorb identical keys already buffered or arriving before the window closes
+  while (true) {
+    ssize_t len = nextSequence(wait_ms);
+    if (len == 0) {
+      if (wait_ms >= 0) {
+        return false; // The rest of a sequence that may be another repeat
+      }
+      int remaining_ms = coalesce_window_ms_ - elapsedMs(run_start_);
+      if (remaining_ms > 0 && !at_end_) {
+        wait_ms = remaining_ms;
+        return false;
+      }
+      break;
+    }
+    if (remapKey(categorizeBuffer(&buf_[buf_begin_], len)) != run_key_) {
+      break; // Leave the different key buffered for the next call
+    }
+    buf_begin_ += len;
+    run_count_++;
+  }
+  key   = run_key_;
+  count = run_count_;
+  run_count_ = 0;
+  at_end_ = false;
+  KeyTrace::trace(KeyTrace::Event::Coalesce, key, count);
+
+  return true;
+}
+
+void ReadKB::setCoalescing(const bool &enable, const int &window_ms, const KeyClass &key_class) {
+  coalesce_ = enable;
+  coalesce_window_ms_ = window_ms > 0 ? window_ms : 0;
+  coalesce_class_ = key_class;
+}
+
+bool ReadKB::query(const Query &query, ReplyCallback callback) {
+  const char *seq = nullptr; // Unknown queries fail
+  switch (query) {
+    case Query::CursorPosition :         seq = "\033[6n";  break;
+    case Query::DeviceStatus :           seq = "\033[5n";  break;
+    case Query::PrimaryAttributes :      seq = "\033[c";   break;
+    case Query::SecondaryAttributes :    seq = "\033[>c";  break;
+    case Query::ExtendedCursorPosition : seq = "\033[?6n"; break;
+  }
+  ssize_t len = seq != nullptr ? strlen(seq) : 0;
+  if (seq == nullptr || num_pending_ == kMaxPendingQueries || write(output_fd_, seq, len) != len) {
+    Reply reply = {};
+    reply.query  = query;
+    reply.status = Reply::Status::Failed;
+    if (callback) { callback(reply); }
+    return false;
+  }
+  pending_[num_pending_++] = PendingQuery{query, std::move(callback)};
+  return true;
+}
+
+std::future<ReadKB::Reply> ReadKB::query(const Query &query) {
+  auto promise = std::make_shared<std::promise<Reply>>();
+  std::future<Reply> reply = promise->get_future();
+  this->query(query, [promise](const Reply &r) { promise->set_value(r); });
+  return reply;
+}
 
-        key_pressed = s > 0 ? categorizeBuffer(buf, s) : Key(Key::ERROR);
+void ReadKB::cancelQueries() {
+  while (num_pending_ > 0) {
+    Reply reply = {};
+    reply.status = Reply::Status::Cancelled;
+    answerQuery(0, reply);
+  }
+}
 
+/// Remove a query from the pending queries and call its callback with `reply`
+void ReadKB::answerQuery(const size_t &index, Reply &reply) {
+  // Remove first, so the callback may send another query
+  ReplyCallback callback = std::move(pending_[index].callback);
+  reply.query = pending_[index].query;
+  for (size_t ii = index + 1; ii < num_pending_; ii++) {
+    pending_[ii-1] = std::move(pending_[ii]);
+  }
+  num_pending_--;
+  if (callback) { callback(reply); }
+}
+
+/// Deliver the sequence in `buf` to the oldest pending query it answers, returning false if it answers none
+bool ReadKB::routeReply(const u_char *buf, const ssize_t len) {
+  if (num_pending_ == 0 || len < 3 || buf[0] != '\033' || buf[1] != '[') {
+    return false;
+  }
+  ssize_t ii = 2;
+  u_char prefix = (buf[ii] == '?' || buf[ii] == '>') ? buf[ii++] : '\0';
+
+  // Numeric parameters separated by ';', before the final char
+  Reply reply = {};
+  reply.count = ii < len - 1 ? 1 : 0;
+  for (; ii < len - 1; ii++) {
+    if (buf[ii] == ';') {
+      reply.count++;
+    } else if (buf[ii] >= '0' && buf[ii] <= '9') {
+      if (reply.count <= kMaxReplyParams) {
+        reply.params[reply.count-1] = reply.params[reply.count-1] * 10 + (buf[ii] - '0');
+      }
+    } else {
+      return false;
+    }
+  }
+  reply.count = reply.count < kMaxReplyParams ? reply.count : kMaxReplyParams;
+
+  Query query;
+  switch (buf[len-1]) { // Final char
+    case 'R' : // Also Shft/Ctrl/Alt-F3 without a prefix, so only a reply when a cursor position is awaited
+      if (prefix == '?' && (reply.count == 2 || reply.count == 3)) {
+        query = Query::ExtendedCursorPosition;
+      } else if (prefix == '\0' && reply.count == 2) {
+        query = Query::CursorPosition;
       } else {
-        // Process other signals (POLLERR | POLLHUP | POLLNVAL)
-        key_pressed = Key::ERROR;
+        return false;
       }
+      break;
+    case 'n' :
+      if (prefix != '\0' || reply.count != 1) { return false; }
+      query = Query::DeviceStatus;
+      break;
+    case 'c' :
+      if (prefix == '\0') { return false; }
+      query = prefix == '?' ? Query::PrimaryAttributes : Query::SecondaryAttributes;
+      break;
+    default :
+      return false;
+  }
+
+  // Terminals answer in order, so the oldest query of the kind is answered
+  for (size_t jj = 0; jj < num_pending_; jj++) {
+    if (pending_[jj].query == query) {
+      reply.status = Reply::Status::Ok;
+      answerQuery(jj, reply);
+      return true;
     }
   }
+  return false;
+}
 
+/// Remove replies to pending queries from the buffer as their sequences complete, keeping the keys around them in order
+void ReadKB::routeReplies() {
+  ssize_t pos = buf_routed_ > buf_begin_ ? buf_routed_ : buf_begin_;
+  while (pos < buf_end_) {
+    ssize_t len = bufferedLength(pos);
+    if (len == 0) {
+      break; // Checked again once the rest of the sequence is read
+    }
+    // A reply directly after an Esc key is decoded as Alt-prefixed, so also check without the Esc
+    ssize_t skip = (len > 2 && buf_[pos] == '\033' && buf_[pos+1] == '\033') ? 1 : 0;
+    if (routeReply(&buf_[pos + skip], len - skip)) {
+      // Close the gap, shifting the marks of lone Esc keys after it too, and check again from the same position
+      memmove(&buf_[pos + skip], &buf_[pos + len], buf_end_ - pos - len);
+      buf_end_ -= len - skip;
+      buf_lone_esc_ = (buf_lone_esc_ & ~(~std::bitset<kBufferSize>() << (pos + skip))) |
+                      ((buf_lone_esc_ >> (pos + len)) << (pos + skip));
+      // The Esc is a key by itself, not a prefix of whatever followed the reply
+      buf_lone_esc_[pos] = buf_lone_esc_[pos] || skip;
+    } else {
+      pos += len;
+    }
+  }
+  buf_routed_ = pos;
+}
+
+/// Length of the key sequence buffered at `pos` as sequenceLength(), but ending before any Esc key left alone
+ssize_t ReadKB::bufferedLength(const ssize_t pos) const {
+  if (buf_lone_esc_[pos]) {
+    return 1;
+  }
+  ssize_t len = sequenceLength(&buf_[pos], buf_end_ - pos);
+  if (buf_lone_esc_.any()) {
+    const ssize_t end = len == 0 ? buf_end_ : pos + len;
+    for (ssize_t ii = pos + 1; ii < end; ii++) {
+      if (buf_lone_esc_[ii]) {
+        return ii - pos;
+      }
+    }
+  }
+  return len;
+}
+
+/// Poll for input and append whatever is available to the key buffer, returning false if nothing was read
+bool ReadKB::fillBuffer(const int timeout_ms) {
+  // Move unconsumed bytes to the front to make room
+  if (buf_begin_ > 0) {
+    memmove(buf_, &buf_[buf_begin_], buf_end_ - buf_begin_);
+    buf_lone_esc_ >>= buf_begin_;
+    buf_routed_ = buf_routed_ > buf_begin_ ? buf_routed_ - buf_begin_ : 0;
+    buf_end_ -= buf_begin_;
+    buf_begin_ = 0;
+  }
+  at_end_ = false;
+  if (buf_end_ == kBufferSize) {
+    return false;
+  }
+
+  int num_ready = poll(&pfd_, 1, timeout_ms);
+  errorIf(num_ready == -1, "poll");
+  KeyTrace::trace(KeyTrace::Event::PollWake, pfd_.fd, (num_ready << 16) | (pfd_.revents & 0xFFFF));
+  if (num_ready == 0 || !(pfd_.revents & POLLIN)) {
+    // Timed out, or other signals (POLLERR | POLLHUP | POLLNVAL) that carry no data
+    at_end_ = num_ready != 0;
+    return false;
+  }
+
+  // Read from the pipe if there is data available (POLLIN)
+  ssize_t s = read(pfd_.fd, &buf_[buf_end_], kBufferSize - buf_end_);
+  errorIf(s == -1, "read");
+  if (KeyTrace::enabled()) {
+    for (ssize_t offset = 0; offset == 0 || offset < s; offset += sizeof(KeyTrace::Record::data)) {
+      KeyTrace::trace(KeyTrace::Event::Read, pfd_.fd, (offset << 16) | s, &buf_[buf_end_ + offset], s - offset);
+    }
+  }
+
+  buf_end_ += s;
+  at_end_ = s == 0;
+  routeReplies();
+  return s > 0;
+}
+
+/// Length of the next key sequence in the buffer, or 0 if nothing is buffered (leaving `wait_ms` at -1) or
+/// if the sequence was split by a short read, setting `wait_ms` to how long to wait for its rest
+ssize_t ReadKB::nextSequence(int &wait_ms) {
+  wait_ms = -1;
+  ssize_t len = buf_begin_ == buf_end_ ? 0 : bufferedLength(buf_begin_);
+  if (len != 0 || buf_begin_ == buf_end_) {
+    split_ = false;
+    return len;
+  }
+
+  // Read what has already arrived, waiting longer for what may be a reply split across reads (e.g. over ssh)
+  const int limit_ms = mayBeReply() ? kReplyWaitMs : 0;
+  if (!split_) {
+    split_ = true;
+    clock_gettime(CLOCK_MONOTONIC, &split_start_);
+    wait_ms = limit_ms;
+    return 0;
+  }
+  int remaining_ms = limit_ms - elapsedMs(split_start_);
+  if (remaining_ms > 0 && !at_end_) {
+    wait_ms = remaining_ms;
+    return 0;
+  }
+
+  // Nothing more is coming, so the remaining bytes form the key (e.g. a lone Esc)
+  split_ = false;
+  return buf_end_ - buf_begin_;
+}
+
+/// Whether the incomplete sequence in the buffer may be the start of a reply to a pending query,
+/// i.e. Esc, then optionally an Esc key, then '[' and the rest
+bool ReadKB::mayBeReply() const {
+  if (num_pending_ == 0) {
+    return false;
+  }
+  const u_char *buf = &buf_[buf_begin_];
+  const ssize_t len = buf_end_ - buf_begin_;
+  ssize_t ii = (len > 1 && buf[0] == '\033' && buf[1] == '\033') ? 1 : 0;
+  return buf[ii] == '\033' && (len == ii + 1 || buf[ii+1] == '[');
+}
+
+ReadKB::Key ReadKB::remapKey(Key key_pressed) {
+  const Key key_decoded = key_pressed;
   // Rename keys as necessary due to OS capturing the default value
   // Combo captured by OS but Ctrl-Combo not
   if (key_pressed == (Mod::Alt & Key::Tab)) {
@@ -116,13 +358,32 @@ ReadKB::Key ReadKB::read_key() const {
       key_pressed == (Mod::Ctrl & Mod::Alt & static_cast<Key>('f')) ||
       key_pressed == (Mod::Ctrl & Mod::Alt & static_cast<Key>('l')) ||
       key_pressed == (Mod::Ctrl & Mod::Alt & static_cast<Key>('t'))) {
-    std::cout << "updated" << std::endl;
     key_pressed &= Mod::Shft;
   }
+  if (key_pressed != key_decoded) {
+    KeyTrace::trace(KeyTrace::Event::Remap, key_decoded, key_pressed);
+  }
 
   return key_pressed;
 }
 
+bool ReadKB::isCoalescable(const Key &key) const {
+  if (key >= Key::ERROR) {
+    return false;
+  }
+  Key base = key.base();
+  switch (coalesce_class_) {
+    case KeyClass::Any :
+      return true;
+    case KeyClass::Navigation :
+      return base == Key::Up     || base == Key::Down  || base == Key::Right  || base == Key::Left ||
+             base == Key::Home   || base == Key::End   || base == Key::PageUp || base == Key::PageDown;
+    case KeyClass::Editing :
+      return base == Key::Backspace || base == Key::Delete;
+  }
+  return false;
+}
+
 void ReadKB::resetTerminal(const int fd) {
   struct termios term;
   if(tcgetattr(fd, &term) == 0) {
@@ -132,19 +393,29 @@ void ReadKB::resetTerminal(const int fd) {
   }
 }
 
+/// Put back the terminal attributes changed by setInput(), if any
+void ReadKB::restoreTerminal() {
+  if (restore_term_) {
+    errorIf(tcsetattr(pfd_.fd, TCSANOW, &saved_term_) == -1, "termios restore");
+    restore_term_ = false;
+  }
+}
+
 void ReadKB::setInput(const int &fd, const InputMode &mode) {
   // Reset original file descriptor
-  resetTerminal(pfds->fd);
+  restoreTerminal();
 
   // Set new mode
   switch (mode) {
     case InputMode::Char :
-      // Turn off OS buffering on standard input (non-canonical mode)
-      struct termios term;
-      if(tcgetattr(fd, &term) == 0) {
+      // Turn off OS buffering on standard input (non-canonical mode), saving the attributes once
+      // so they can be restored without querying again
+      if(tcgetattr(fd, &saved_term_) == 0 && (saved_term_.c_lflag & (ICANON | ECHO))) {
+        struct termios term = saved_term_;
         term.c_lflag &= ~ICANON; // Non-canonical mode
         term.c_lflag &= ~ECHO;   // Do not print input
         errorIf(tcsetattr(fd, TCSANOW, &term) == -1, "termios");
+        restore_term_ = true;
       }
       break;
     case InputMode::Line :
@@ -157,12 +428,75 @@ void ReadKB::setInput(const int &fd, const InputMode &mode) {
   mode_ = mode;
 
   // Assign file descriptor to poll structure
-  pfds->fd = fd;
-  errorIf(pfds->fd == -1, "open");
-  printlog("Reading input from fd %d\n", pfds->fd);
+  pfd_.fd = fd;
+  errorIf(pfd_.fd == -1, "open");
 }
 
-ReadKB::Key ReadKB::categorizeBuffer(const u_char *buf, const ssize_t len) const {
+/// Return the length of the first key sequence in the buffer, or 0 if the buffer ends part way through it
+ssize_t ReadKB::sequenceLength(const u_char *buf, const ssize_t len) {
+  assert(len > 0 && "Nothing in buffer to process");
+  if (buf[0] != '\033') {
+    // ASCII, or a UTF-8 lead byte followed by its continuation bytes
+    ssize_t n = 1;
+    if      ((buf[0] & 0xE0) == 0xC0) { n = 2; }
+    else if ((buf[0] & 0xF0) == 0xE0) { n = 3; }
+    else if ((buf[0] & 0xF8) == 0xF0) { n = 4; }
+    for (ssize_t ii = 1; ii < n; ii++) {
+      if (ii == len) { return 0; }
+      if ((buf[ii] & 0xC0) != 0x80) { return ii; }
+    }
+    return n;
+  }
+
+  if (len == 1) { return 0; } // Esc, or the start of a sequence
+  switch (buf[1]) {
+    case '[' : // Control Sequence Introducer
+      // Parameter (0x30-0x3F) and intermediate (0x20-0x2F) bytes, then a final byte (0x40-0x7E)
+      // Sequences are cut off at kMaxSequenceLength, bounding the length of any key
+      for (ssize_t ii = 2; ii < len && ii < kMaxSequenceLength; ii++) {
+        if (buf[ii] >= 0x20 && buf[ii] <= 0x3F) { continue; }
+        return (buf[ii] >= 0x40 && buf[ii] <= 0x7E) ? ii + 1 : ii;
+      }
+      return len < kMaxSequenceLength ? 0 : kMaxSequenceLength;
+    case 'O' : // Single Shift Three
+      return len > 2 ? 3 : 0;
+    default : { // Alt-key
+      ssize_t n = sequenceLength(&buf[1], len - 1);
+      return n == 0 ? 0 : n + 1;
+    }
+  }
+}
+
+ssize_t ReadKB::decode(const u_char *buf, const ssize_t &len, Key &key) {
+  ssize_t seq_len = sequenceLength(buf, len);
+  // Nothing follows, so the remaining bytes form the key (e.g. a lone Esc)
+  seq_len = seq_len == 0 ? len : seq_len;
+  key = remapKey(categorizeBuffer(buf, seq_len));
+  return seq_len;
+}
+
+ssize_t ReadKB::syncPoint(const u_char *buf, const ssize_t &len, const ssize_t &pos) {
+  // Only Esc starts a multi-byte sequence, and an Esc can only continue a sequence as an
+  // Alt-prefixed key (after another Esc) or as the final char of an SS3 sequence (after 'O').
+  // A position is therefore safe before an Esc that follows anything else, or once no Esc
+  // has been seen for longer than the longest sequence (not part way through a UTF-8 char).
+  ssize_t last_esc = -kMaxSequenceLength - 1;
+  for (ssize_t ii = pos > kMaxSequenceLength ? pos - kMaxSequenceLength : 0; ii < pos && ii < len; ii++) {
+    if (buf[ii] == '\033') { last_esc = ii; }
+  }
+  for (ssize_t ii = pos > 0 ? pos : 0; ii < len; ii++) {
+    if (ii == 0) { return 0; }
+    if (buf[ii] == '\033') {
+      if (buf[ii-1] != '\033' && buf[ii-1] != 'O') { return ii; }
+      last_esc = ii;
+    } else if (ii - last_esc > kMaxSequenceLength && (buf[ii] & 0xC0) != 0x80) {
+      return ii;
+    }
+  }
+  return len;
+}
+
+ReadKB::Key ReadKB::categorizeBuffer(const u_char *buf, const ssize_t len) {
   assert(len > 0 && "Nothing in buffer to process");
   Key key_pressed;
   if (len == 1 && buf[0] <= 127) {
@@ -189,7 +523,7 @@ ReadKB::Key ReadKB::categorizeBuffer(const u_char *buf, const ssize_t len) const
   return key_pressed;
 };
 
-ReadKB::Key ReadKB::categorizeFunction(const u_char *buf, const ssize_t len) const {
+ReadKB::Key ReadKB::categorizeFunction(const u_char *buf, const ssize_t len) {
   assert(len > 0 && "Nothing in buffer to process");
   Key key_pressed;
   switch (buf[len-1]) { // Last character
@@ -235,14 +569,19 @@ ReadKB::Key ReadKB::categorizeFunction(const u_char *buf, const ssize_t len) con
 
   Modifier mod;
   if (len >= 4) {
-    mod = categorizeMod(buf[len-2]); // Categorize penultimate character
+    // Modifiers are the last parameter (e.g. ESC [ 1 ; 5 A), anything else is not a known key
+    if (buf[len-3] == ';' && buf[len-2] >= '2' && buf[len-2] <= '8') {
+      mod = categorizeMod(buf[len-2]); // Categorize penultimate character
+    } else {
+      key_pressed = Key::UNDEFINED_CSI;
+    }
   }
 
   return mod & key_pressed;
 };
 
 /// Return the combination of Shft, Ctrl, and Alt corresponding to the terminal encoding of a numeric char
-ReadKB::Modifier ReadKB::categorizeMod(const u_char c) const {
+ReadKB::Modifier ReadKB::categorizeMod(const u_char c) {
   assert(c >= '2' && c <= '8' && "Encoded char is out of range");
   int i = c - 49; // ASCII '2', '3', '4', ... -> int 1, 2, 3, ...
   Modifier mod(static_cast<BitmaskSet>(0), static_cast<BitmaskClear>(0));
@@ -252,93 +591,115 @@ ReadKB::Modifier ReadKB::categorizeMod(const u_char c) const {
   return mod;
 };
 
-std::ostream& operator<<(std::ostream& os, const ReadKB::Key& kbMods) {
-  // Remove modifiers and add to output stream
-  ReadKB::Key kb = kbMods;
-  if(kb != kb.unsetMask(ReadKB::Mod::Ctrl)) { os << "Ctrl-"; }
-  if(kb != kb.unsetMask(ReadKB::Mod::Alt))  { os << "Alt-"; }
+size_t ReadKB::Key::format(char *buf, const size_t &size) const {
+  char str[kMaxNameLength];
+  size_t len = 0;
+  auto append = [&](const char *name) {
+    while (*name != '\0' && len < kMaxNameLength - 1) { str[len++] = *name++; }
+  };
+
+  // Remove modifiers and add to name
+  ReadKB::Key kb = *this;
+  if(kb != kb.unsetMask(ReadKB::Mod::Ctrl)) { append("Ctrl-"); }
+  if(kb != kb.unsetMask(ReadKB::Mod::Alt))  { append("Alt-"); }
   if(kb == (kb & ReadKB::Mod::Event) &&
-     kb != kb.unsetMask(ReadKB::Mod::Shft)) { os << "Shft-"; }
+     kb != kb.unsetMask(ReadKB::Mod::Shft)) { append("Shft-"); }
 
   // Decode base key
   if ((kb >= static_cast<uint>('a') && kb <= static_cast<uint>('z')) ||
       (kb >= static_cast<uint>('A') && kb <= static_cast<uint>('Z')) ||
       (kb >= static_cast<uint>('0') && kb <= static_cast<uint>('9'))) {
     // Alphanumeric
-    os << static_cast<char>(kb.mkey);
+    const char name[] = {static_cast<char>(kb.mkey), '\0'};
+    append(name);
   } else {
+    const char *name;
     switch (kb) {
-      case ReadKB::Key::DoubleQuote  : os << "\"";     break;
-      case ReadKB::Key::LeftAngle    : os << "<";      break;
-      case ReadKB::Key::Underscore   : os << "_";      break;
-      case ReadKB::Key::RightAngle   : os << ">";      break;
-      case ReadKB::Key::Question     : os << "?";      break;
-      case ReadKB::Key::RightParen   : os << ")";      break;
-      case ReadKB::Key::Exclamation  : os << "!";      break;
-      case ReadKB::Key::At           : os << "@";      break;
-      case ReadKB::Key::Hash         : os << "#";      break;
-      case ReadKB::Key::Dollar       : os << "$";      break;
-      case ReadKB::Key::Percent      : os << "%";      break;
-      case ReadKB::Key::Circumflex   : os << "^";      break;
-      case ReadKB::Key::Ampersand    : os << "&";      break;
-      case ReadKB::Key::Asterisk     : os << "*";      break;
-      case ReadKB::Key::LeftParen    : os << "(";      break;
-      case ReadKB::Key::Colon        : os << ":";      break;
-      case ReadKB::Key::Plus         : os << "+";      break;
-      case ReadKB::Key::Space        : os << " ";      break;
-      case ReadKB::Key::Quote        : os << "'";      break;
-      case ReadKB::Key::Comma        : os << ",";      break;
-      case ReadKB::Key::Dash         : os << "-";      break;
-      case ReadKB::Key::Period       : os << ".";      break;
-      case ReadKB::Key::Slash        : os << "/";      break;
-      case ReadKB::Key::Semicolon    : os << ";";      break;
-      case ReadKB::Key::Equal        : os << "=";      break;
-      case ReadKB::Key::Tilde        : os << "~";      break;
-      case ReadKB::Key::LeftBrace    : os << "{";      break;
-      case ReadKB::Key::Pipe         : os << "|";      break;
-      case ReadKB::Key::RightBrace   : os << "}";      break;
-      case ReadKB::Key::Grave        : os << "`";      break;
-      case ReadKB::Key::LeftBracket  : os << "[";      break;
-      case ReadKB::Key::Backslash    : os << "\\";     break;
-      case ReadKB::Key::RightBracket : os << "]";      break;
-      case ReadKB::Key::Backspace    : os << "Bksp";   break;
-      case ReadKB::Key::Insert       : os << "Ins";    break;
-      case ReadKB::Key::Delete       : os << "Del";    break;
-      case ReadKB::Key::PageUp       : os << "PgUp";   break;
-      case ReadKB::Key::PageDown     : os << "PgDn";   break;
-      case ReadKB::Key::F1           : os << "F1";     break;
-      case ReadKB::Key::F2           : os << "F2";     break;
-      case ReadKB::Key::F3           : os << "F3";     break;
-      case ReadKB::Key::F4           : os << "F4";     break;
-      case ReadKB::Key::F5           : os << "F5";     break;
-      case ReadKB::Key::F6           : os << "F6";     break;
-      case ReadKB::Key::F7           : os << "F7";     break;
-      case ReadKB::Key::F8           : os << "F8";     break;
-      case ReadKB::Key::F9           : os << "F9";     break;
-      case ReadKB::Key::F10          : os << "F10";    break;
-      case ReadKB::Key::F11          : os << "F11";    break;
-      case ReadKB::Key::F12          : os << "F12";    break;
-      case ReadKB::Key::Up           : os << "Up";     break;
-      case ReadKB::Key::Down         : os << "Down";   break;
-      case ReadKB::Key::Right        : os << "Right";  break;
-      case ReadKB::Key::Left         : os << "Left";   break;
-      case ReadKB::Key::Center       : os << "Center"; break;
-      case ReadKB::Key::End          : os << "End";    break;
-      case ReadKB::Key::Home         : os << "Home";   break;
-      case ReadKB::Key::Tab          : os << "Tab";    break;
-      case ReadKB::Key::Enter        : os << "Enter";  break;
-      case ReadKB::Key::Esc          : os << "Esc";    break;
+      case ReadKB::Key::DoubleQuote  : name = "\"";     break;
+      case ReadKB::Key::LeftAngle    : name = "<";      break;
+      case ReadKB::Key::Underscore   : name = "_";      break;
+      case ReadKB::Key::RightAngle   : name = ">";      break;
+      case ReadKB::Key::Question     : name = "?";      break;
+      case ReadKB::Key::RightParen   : name = ")";      break;
+      case ReadKB::Key::Exclamation  : name = "!";      break;
+      case ReadKB::Key::At           : name = "@";      break;
+      case ReadKB::Key::Hash         : name = "#";      break;
+      case ReadKB::Key::Dollar       : name = "$";      break;
+      case ReadKB::Key::Percent      : name = "%";      break;
+      case ReadKB::Key::Circumflex   : name = "^";      break;
+      case ReadKB::Key::Ampersand    : name = "&";      break;
+      case ReadKB::Key::Asterisk     : name = "*";      break;
+      case ReadKB::Key::LeftParen    : name = "(";      break;
+      case ReadKB::Key::Colon        : name = ":";      break;
+      case ReadKB::Key::Plus         : name = "+";      break;
+      case ReadKB::Key::Space        : name = " ";      break;
+      case ReadKB::Key::Quote        : name = "'";      break;
+      case ReadKB::Key::Comma        : name = ",";      break;
+      case ReadKB::Key::Dash         : name = "-";      break;
+      case ReadKB::Key::Period       : name = ".";      break;
+      case ReadKB::Key::Slash        : name = "/";      break;
+      case ReadKB::Key::Semicolon    : name = ";";      break;
+      case ReadKB::Key::Equal        : name = "=";      break;
+      case ReadKB::Key::Tilde        : name = "~";      break;
+      case ReadKB::Key::LeftBrace    : name = "{";      break;
+      case ReadKB::Key::Pipe         : name = "|";      break;
+      case ReadKB::Key::RightBrace   : name = "}";      break;
+      case ReadKB::Key::Grave        : name = "`";      break;
+      case ReadKB::Key::LeftBracket  : name = "[";      break;
+      case ReadKB::Key::Backslash    : name = "\\";     break;
+      case ReadKB::Key::RightBracket : name = "]";      break;
+      case ReadKB::Key::Backspace    : name = "Bksp";   break;
+      case ReadKB::Key::Insert       : name = "Ins";    break;
+      case ReadKB::Key::Delete       : name = "Del";    break;
+      case ReadKB::Key::PageUp       : name = "PgUp";   break;
+      case ReadKB::Key::PageDown     : name = "PgDn";   break;
+      case ReadKB::Key::F1           : name = "F1";     break;
+      case ReadKB::Key::F2           : name = "F2";     break;
+      case ReadKB::Key::F3           : name = "F3";     break;
+      case ReadKB::Key::F4           : name = "F4";     break;
+      case ReadKB::Key::F5           : name = "F5";     break;
+      case ReadKB::Key::F6           : name = "F6";     break;
+      case ReadKB::Key::F7           : name = "F7";     break;
+      case ReadKB::Key::F8           : name = "F8";     break;
+      case ReadKB::Key::F9           : name = "F9";     break;
+      case ReadKB::Key::F10          : name = "F10";    break;
+      case ReadKB::Key::F11          : name = "F11";    break;
+      case ReadKB::Key::F12          : name = "F12";    break;
+      case ReadKB::Key::Up           : name = "Up";     break;
+      case ReadKB::Key::Down         : name = "Down";   break;
+      case ReadKB::Key::Right        : name = "Right";  break;
+      case ReadKB::Key::Left         : name = "Left";   break;
+      case ReadKB::Key::Center       : name = "Center"; break;
+      case ReadKB::Key::End          : name = "End";    break;
+      case ReadKB::Key::Home         : name = "Home";   break;
+      case ReadKB::Key::Tab          : name = "Tab";    break;
+      case ReadKB::Key::Enter        : name = "Enter";  break;
+      case ReadKB::Key::Esc          : name = "Esc";    break;
       // Special Cases
       case ReadKB::Mod::Shft & static_cast<ReadKB::Key>(' ') // Space not an "Event" key
-                                         : os << "Shft-Space"; break;
+                                         : name = "Shft-Space"; break;
       // Error Codes
-      case ReadKB::Key::UNDEFINED_CSI    : os << "Undef-CSI"; break;
-      case ReadKB::Key::UNDEFINED_SS3    : os << "Undef-SS3"; break;
-      case ReadKB::Key::UNDEFINED_ESCAPE : os << "Undef-Esc"; break;
-      case ReadKB::Key::UNDEFINED        : os << "Undefined"; break;
-      case ReadKB::Key::ERROR            : os << "Error";     break;
-      default : os << "Disp-Error"; break;
+      case ReadKB::Key::UNDEFINED_CSI    : name = "Undef-CSI"; break;
+      case ReadKB::Key::UNDEFINED_SS3    : name = "Undef-SS3"; break;
+      case ReadKB::Key::UNDEFINED_ESCAPE : name = "Undef-Esc"; break;
+      case ReadKB::Key::UNDEFINED        : name = "Undefined"; break;
+      case ReadKB::Key::ERROR            : name = "Error";     break;
+      default : name = "Disp-Error"; break;
     }
+    append(name);
+  }
+  str[len] = '\0';
+
+  if (size > 0) {
+    size_t copied = len < size - 1 ? len : size - 1;
+    memcpy(buf, str, copied);
+    buf[copied] = '\0';
   }
-  return os;
+  return len;
+}
+
+std::ostream& operator<<(std::ostream& os, const ReadKB::Key& kb) {
+  char name[ReadKB::Key::kMaxNameLength];
+  kb.format(name, sizeof(name));
+  return os << name;
 }
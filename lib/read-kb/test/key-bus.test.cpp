@@ -0,0 +1,150 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "key-bus.h"
+#include "read-kb.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+int main() {
+
+  // Initialize exit status
+  int st = EXIT_SUCCESS;
+
+  const std::string name = "/read-kb-test-" + std::to_string(getpid());
+  const ReadKB::Key keys[] = {
+    ReadKB::Key('a'),
+    ReadKB::Mod::Ctrl & ReadKB::Mod::Shft & ReadKB::Key::Up,
+    ReadKB::Mod::Alt & ReadKB::Key('Z'),
+  };
+
+  KeyBus::Publisher pub(name, 4);
+  KeyBus::Subscriber sub(name);
+  KeyBus::Record rec;
+
+  // Nothing published yet
+  st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Empty),
+               "Empty bus");
+
+  // Records are read in order with their modifiers
+  for (const ReadKB::Key &key : keys) {
+    pub.publish(key);
+  }
+  for (uint64_t ii = 0; ii < 3; ii++) {
+    st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Ok),
+                 "Read published record");
+    st |= testEq(rec.key, keys[ii], "Record key");
+    st |= testEq(rec.modifiers, keys[ii].modifiers(), "Record modifiers");
+    st |= testEq(rec.sequence, ii, "Record sequence");
+  }
+  st |= testEq(keys[1].modifiers(), ReadKB::Key::CtrlBit | ReadKB::Key::ShftBit, "Ctrl-Shft modifiers");
+  st |= testEq(keys[2].modifiers(), ReadKB::Key::AltBit, "Alt modifiers");
+  st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Empty),
+               "Bus drained");
+
+  // A subscriber that falls more than one lap behind detects the overrun and resumes at the oldest record
+  for (int ii = 0; ii < 10; ii++) {
+    pub.publish(ReadKB::Key(static_cast<char>('0' + ii)));
+  }
+  st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Overrun),
+               "Overrun detected");
+  st |= testEq(sub.dropped(), 6, "Records dropped");
+  for (uint64_t ii = 9; ii < 13; ii++) {
+    st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Ok),
+                 "Read after overrun");
+    st |= testEq(rec.sequence, ii, "Sequence after overrun");
+    st |= testEq(rec.key, ReadKB::Key(static_cast<char>('0' + ii - 3)), "Key after overrun");
+  }
+
+  // Records reach a subscriber in another process
+  int ready[2];
+  errorIf(pipe(ready) == -1, "pipe");
+  pid_t pid = fork();
+  errorIf(pid == -1, "fork");
+  if (pid == 0) {
+    KeyBus::Subscriber child(name);
+    errorIf(write(ready[1], "", 1) != 1, "write");
+    int child_st = EXIT_SUCCESS;
+    for (const ReadKB::Key &key : keys) {
+      child_st |= testEq(static_cast<uint64_t>(child.wait(rec, 5000)),
+                         static_cast<uint64_t>(KeyBus::Subscriber::Status::Ok), "Wait in other process");
+      child_st |= testEq(rec.key, key, "Key in other process");
+    }
+    _exit(child_st);
+  }
+  char c;
+  errorIf(read(ready[0], &c, 1) != 1, "read");
+  for (const ReadKB::Key &key : keys) {
+    pub.publish(key);
+  }
+  int status;
+  errorIf(waitpid(pid, &status, 0) == -1, "waitpid");
+  st |= testEq(WIFEXITED(status) ? WEXITSTATUS(status) : -1, EXIT_SUCCESS, "Subscriber process");
+
+  // Waiting times out when nothing is published
+  st |= testEq(static_cast<uint64_t>(sub.read(rec)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Ok),
+               "Parent reads too");
+  sub.read(rec);
+  sub.read(rec);
+  st |= testEq(static_cast<uint64_t>(sub.wait(rec, 10)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Empty),
+               "Wait timeout");
+
+  // The object is readable only by its owner unless a mode is given
+  struct stat info;
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  errorIf(fd == -1 || fstat(fd, &info) == -1, "shm_open");
+  close(fd);
+  st |= testEq(info.st_mode & 0777, 0600, "Default mode");
+  {
+    KeyBus::Publisher shared(name + "-shared", 4, 0640);
+    fd = shm_open((name + "-shared").c_str(), O_RDONLY, 0);
+    errorIf(fd == -1 || fstat(fd, &info) == -1, "shm_open");
+    close(fd);
+    st |= testEq(info.st_mode & 0777, 0640, "Explicit mode");
+  }
+
+  // Remaining records are still read after the publisher closes, then waiting ends
+  {
+    KeyBus::Publisher *closing = new KeyBus::Publisher(name + "-closing", 4);
+    KeyBus::Subscriber closed(name + "-closing");
+    closing->publish(keys[0]);
+    delete closing;
+    st |= testEq(static_cast<uint64_t>(closed.wait(rec, -1)), static_cast<uint64_t>(KeyBus::Subscriber::Status::Ok),
+                 "Read after close");
+    st |= testEq(rec.key, keys[0], "Key after close");
+    st |= testEq(static_cast<uint64_t>(closed.wait(rec, -1)),
+                 static_cast<uint64_t>(KeyBus::Subscriber::Status::Closed), "Wait after close");
+  }
+
+  // Waiting also ends when the publisher exits without closing
+  pid = fork();
+  errorIf(pid == -1, "fork");
+  if (pid == 0) {
+    new KeyBus::Publisher(name + "-exited", 4);
+    errorIf(write(ready[1], "", 1) != 1, "write");
+    _exit(EXIT_SUCCESS);
+  }
+  errorIf(read(ready[0], &c, 1) != 1, "read");
+  {
+    KeyBus::Subscriber orphan(name + "-exited");
+    errorIf(waitpid(pid, &status, 0) == -1, "waitpid");
+    st |= testEq(static_cast<uint64_t>(orphan.wait(rec, -1)),
+                 static_cast<uint64_t>(KeyBus::Subscriber::Status::Closed), "Wait after publisher exit");
+  }
+  shm_unlink((name + "-exited").c_str());
+
+  // Display Test Statuses
+  return reportTests(st);
+}
@@ -0,0 +1,107 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "key-trace.h"
+#include "read-kb.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/// Description of a record without its sequence number and timestamp
+std::string describe(const KeyTrace::Record &record) {
+  std::ostringstream os;
+  os << record;
+  return os.str().substr(os.str().find("  ", 12) + 2);
+}
+
+/// Write `input` to the temporary file and read `keys` keys back from it
+void readKeys(ReadKB &kb, const int &fd, const std::string &input, const int &keys) {
+  ssize_t s;
+  errorIf((s = write(fd, input.c_str(), input.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (int ii = 0; ii < keys; ii++) {
+    kb.read_key();
+  }
+}
+
+int main() {
+
+  // Initialize exit status
+  int st = EXIT_SUCCESS;
+
+  const std::string tempdir = "/tmp";
+  int fd = open(tempdir.c_str(), O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR );
+  errorIf(fd == -1, std::string("open temp in directory: " + tempdir).c_str());
+
+  ReadKB kb;
+  kb.setInput(fd, ReadKB::InputMode::Char);
+  KeyTrace::Record records[KeyTrace::kCapacity];
+
+  // Nothing is recorded while disabled
+  KeyTrace::enable(false);
+  size_t before = KeyTrace::snapshot(records, KeyTrace::kCapacity);
+  readKeys(kb, fd, "a", 1);
+  st |= testEq(std::to_string(KeyTrace::snapshot(records, KeyTrace::kCapacity)), std::to_string(before),
+               "Disabled trace");
+
+  // Poll wakeups, raw bytes, decoded keys, and remaps are recorded while enabled
+  KeyTrace::enable(true);
+  readKeys(kb, fd, "\033[1;5A\033\006x", 2);
+  KeyTrace::enable(false);
+  size_t count = KeyTrace::snapshot(records, KeyTrace::kCapacity);
+  const std::string ans[] = {
+    "poll     fd=" + std::to_string(fd) + " ready=1 revents=POLLIN ",
+    "read     fd=" + std::to_string(fd) + " bytes=9 +0: ^[ [ 1 ; 5 A ^[ ^F",
+    "read     fd=" + std::to_string(fd) + " bytes=9 +8: x",
+    "decode   Ctrl-Up (6 bytes)",
+    "decode   Ctrl-Alt-f (2 bytes)",
+    "remap    Ctrl-Alt-f -> Ctrl-Alt-F",
+  };
+  const size_t num_ans = sizeof(ans) / sizeof(ans[0]);
+  st |= testEq(std::to_string(count - before), std::to_string(num_ans), "Records traced");
+  for (size_t ii = 0; ii < num_ans && before + ii < count; ii++) {
+    st |= testEq(describe(records[before + ii]), ans[ii], "Trace record");
+    if (ii > 0) {
+      st |= testEq(std::to_string(records[before + ii].sequence - records[before + ii - 1].sequence), "1",
+                   "Trace sequence");
+    }
+  }
+
+  // Binary dump holds a header and every record
+  int dump_fd = open(tempdir.c_str(), O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR );
+  errorIf(dump_fd == -1, "open dump");
+  st |= testEq(KeyTrace::dump(dump_fd) ? "ok" : "failed", "ok", "Dump trace");
+  KeyTrace::DumpHeader header;
+  errorIf(pread(dump_fd, &header, sizeof(header), 0) != sizeof(header), "read dump");
+  st |= testEq(std::to_string(header.count), std::to_string(count), "Dump record count");
+  st |= testEq(std::to_string(lseek(dump_fd, 0, SEEK_END)),
+               std::to_string(sizeof(header) + count * sizeof(KeyTrace::Record)), "Dump size");
+  KeyTrace::Record last;
+  errorIf(pread(dump_fd, &last, sizeof(last), sizeof(header) + (count - 1) * sizeof(last)) != sizeof(last),
+          "read dump");
+  st |= testEq(describe(last), ans[num_ans - 1], "Dumped record");
+
+  // Dumps are readable only by their owner, even when replacing a file that was not
+  const std::string dump_path = tempdir + "/read-kb-trace-test-" + std::to_string(getpid());
+  int old_fd = open(dump_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  errorIf(old_fd == -1 || fchmod(old_fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1, "create old dump");
+  close(old_fd);
+  st |= testEq(KeyTrace::dump(dump_path.c_str()) ? "ok" : "failed", "ok", "Dump trace to path");
+  struct stat info;
+  errorIf(stat(dump_path.c_str(), &info) == -1, "stat dump");
+  st |= testEq(info.st_mode & 0777, 0600, "Dump mode");
+  unlink(dump_path.c_str());
+
+  // Display Test Statuses
+  return reportTests(st);
+}
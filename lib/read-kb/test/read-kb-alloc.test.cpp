@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+// Check that reading, decoding, and formatting keys never allocate after construction
+
+#include "key-trace.h"
+#include "read-kb.h"
+#include "test-util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+
+// Count every heap allocation made while armed, through malloc() or operator new
+static bool   g_armed = false;
+static size_t g_allocations = 0;
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void *ptr, size_t size);
+void  __libc_free(void *ptr);
+
+void* malloc(size_t size)                 { g_allocations += g_armed; return __libc_malloc(size); }
+void* calloc(size_t num, size_t size)     { g_allocations += g_armed; return __libc_calloc(num, size); }
+void* realloc(void *ptr, size_t size)     { g_allocations += g_armed; return __libc_realloc(ptr, size); }
+void  free(void *ptr)                     { __libc_free(ptr); }
+}
+
+void* operator new(size_t size) {
+  g_allocations += g_armed;
+  void *ptr = __libc_malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) { throw std::bad_alloc(); }
+  return ptr;
+}
+void* operator new[](size_t size)               { return operator new(size); }
+void  operator delete(void *ptr) noexcept         { __libc_free(ptr); }
+void  operator delete[](void *ptr) noexcept       { __libc_free(ptr); }
+void  operator delete(void *ptr, size_t) noexcept   { __libc_free(ptr); }
+void  operator delete[](void *ptr, size_t) noexcept { __libc_free(ptr); }
+
+int main() {
+
+  // Initialize exit status
+  int st = EXIT_SUCCESS;
+
+  // The hooks must see allocations for the test to mean anything
+  g_armed = true;
+  std::string *probe = new std::string(100, 'x');
+  g_armed = false;
+  st |= testEq(g_allocations > 0 ? "hooked" : "missed", "hooked", "Allocation hook");
+  delete probe;
+
+  // Load the character sequences of the test data set as one stream; adjacent
+  // sequences may then decode as one key (e.g. Esc followed by a letter)
+  std::ifstream datafile("input.txt");
+  errorIf(!datafile.is_open(), "open data");
+  std::string corpus;
+  std::string line;
+  while ( getline(datafile, line) ) {
+    if ( line.length() == 0 || line.at(0) == ' ' ) { continue; } // Comment character
+    corpus += line.substr(line.rfind(" ") + 1);
+  }
+  datafile.close();
+
+  const std::string tempdir = "/tmp";
+  int fd = open(tempdir.c_str(), O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR );
+  errorIf(fd == -1, std::string("open temp in directory: " + tempdir).c_str());
+  ReadKB kb;
+  kb.setInput(fd, ReadKB::InputMode::Char);
+  const u_char *buf = reinterpret_cast<const u_char*>(corpus.c_str());
+  const ssize_t len = corpus.length();
+  char name[ReadKB::Key::kMaxNameLength];
+  size_t keys_read = 0;
+  size_t keys_decoded = 0;
+
+  // Run the corpus through every path, with tracing and coalescing on for part of it
+  g_allocations = 0;
+  g_armed = true;
+  for (int pass = 0; pass < 3; pass++) {
+    KeyTrace::enable(pass == 1);
+    kb.setCoalescing(pass == 2);
+    errorIf(write(fd, buf, len) != len, "write");
+    errorIf(lseek(fd, -len, SEEK_CUR) == -1, "lseek");
+    uint count;
+    for (ReadKB::Key key = kb.read_key(count); key != ReadKB::Key::ERROR; key = kb.read_key(count)) {
+      key.format(name, sizeof(name));
+      keys_read += count;
+    }
+  }
+  KeyTrace::enable(false);
+  for (ssize_t pos = 0; pos < len; keys_decoded++) {
+    ReadKB::Key key;
+    pos += ReadKB::decode(&buf[pos], len - pos, key);
+    key.format(name, sizeof(name));
+  }
+  g_armed = false;
+
+  st |= testEq(std::to_string(g_allocations), "0", "Allocations while reading keys");
+  st |= testEq(std::to_string(keys_read), std::to_string(3 * keys_decoded), "Keys read match keys decoded");
+
+  // Display Test Statuses
+  return reportTests(st);
+}
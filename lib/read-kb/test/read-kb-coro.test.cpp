@@ -0,0 +1,135 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#include "read-kb-coro.h"
+#include "read-kb.h"
+#include "test-util.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// Minimal fire-and-forget coroutine type, run until its first suspension on creation
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+/// Read `count` keys, then one more that is expected to time out
+Detached readKeys(AsyncReadKB kb, const int count, std::vector<std::string> &names) {
+  using namespace std::chrono_literals;
+  for (int ii = 0; ii < count; ii++) {
+    std::optional<ReadKB::Key> key = co_await kb.next_key(1000ms);
+    std::ostringstream os;
+    if (key) { os << *key; } else { os << "Timeout"; }
+    names.push_back(os.str());
+  }
+  std::optional<ReadKB::Key> key = co_await kb.next_key(10ms);
+  names.push_back(key ? "Key" : "Timeout");
+}
+
+/// Read one key into the log shared by several sessions, showing the order keys arrive in
+Detached logKey(AsyncReadKB kb, std::vector<std::string> &log) {
+  using namespace std::chrono_literals;
+  std::optional<ReadKB::Key> key = co_await kb.next_key(1000ms);
+  std::ostringstream os;
+  if (key) { os << *key; } else { os << "Timeout"; }
+  log.push_back(os.str());
+}
+
+int main() {
+
+  // Initialize exit status
+  int st = EXIT_SUCCESS;
+
+  // Two interactive sessions multiplexed on one thread, and a third awaiting a reply to a query
+  int fds1[2], fds2[2], fds3[2], query_fds[2];
+  errorIf(pipe(fds1) == -1, "pipe");
+  errorIf(pipe(fds2) == -1, "pipe");
+  errorIf(pipe(fds3) == -1, "pipe");
+  errorIf(pipe(query_fds) == -1, "pipe");
+  ReadKB kb1, kb2, kb3;
+  kb1.setInput(fds1[0], ReadKB::InputMode::Char);
+  kb2.setInput(fds2[0], ReadKB::InputMode::Char);
+  kb3.setInput(fds3[0], ReadKB::InputMode::Char);
+  kb3.setOutput(query_fds[1]);
+  std::future<ReadKB::Reply> cursor = kb3.query(ReadKB::Query::CursorPosition);
+
+  EpollScheduler scheduler;
+  std::vector<std::string> names1, names2, names3;
+  readKeys(AsyncReadKB(kb1, scheduler), 3, names1);
+  readKeys(AsyncReadKB(kb2, scheduler), 1, names2);
+  readKeys(AsyncReadKB(kb3, scheduler), 0, names3);
+
+  // Nothing can be read until the scheduler runs
+  st |= testEq(std::to_string(names1.size() + names2.size()), "0", "Coroutines suspended");
+
+  const std::string input1 = "a\033[A\033[1;5D";
+  const std::string input2 = "\033";
+  errorIf(write(fds1[1], input1.c_str(), input1.length()) == -1, "write");
+  errorIf(write(fds2[1], input2.c_str(), input2.length()) == -1, "write");
+  // Waking for a reply alone must not block the scheduler waiting for a key
+  const std::string input3 = "\033[5;6R";
+  errorIf(write(fds3[1], input3.c_str(), input3.length()) == -1, "write");
+  scheduler.run();
+
+  const std::vector<std::string> ans1 = {"a", "Up", "Ctrl-Left", "Timeout"};
+  const std::vector<std::string> ans2 = {"Esc", "Timeout"};
+  st |= testEq(std::to_string(names1.size()), std::to_string(ans1.size()), "Keys read by session 1");
+  st |= testEq(std::to_string(names2.size()), std::to_string(ans2.size()), "Keys read by session 2");
+  for (size_t ii = 0; ii < names1.size() && ii < ans1.size(); ii++) {
+    st |= testEq(names1[ii], ans1[ii], "Session 1 key");
+  }
+  for (size_t ii = 0; ii < names2.size() && ii < ans2.size(); ii++) {
+    st |= testEq(names2[ii], ans2[ii], "Session 2 key");
+  }
+
+  st |= testEq(names3.size() == 1 ? names3[0] : "No key", "Timeout", "Session 3 key");
+  st |= testEq(cursor.wait_for(std::chrono::seconds(0)) == std::future_status::ready
+               ? std::to_string(cursor.get().params[1]) : "Not ready", "6", "Session 3 reply");
+
+  // Waits for the rest of a possible reply, and for repeats, are left to the scheduler and block no other session
+  int fds4[2], fds5[2], fds6[2];
+  errorIf(pipe(fds4) == -1, "pipe");
+  errorIf(pipe(fds5) == -1, "pipe");
+  errorIf(pipe(fds6) == -1, "pipe");
+  ReadKB kb4, kb5, kb6;
+  kb4.setInput(fds4[0], ReadKB::InputMode::Char);
+  kb5.setInput(fds5[0], ReadKB::InputMode::Char);
+  kb6.setInput(fds6[0], ReadKB::InputMode::Char);
+  kb4.setOutput(query_fds[1]);
+  kb4.query(ReadKB::Query::CursorPosition, nullptr);
+  kb5.setCoalescing(true, 2 * ReadKB::kReplyWaitMs);
+  std::vector<std::string> log;
+  logKey(AsyncReadKB(kb4, scheduler), log);
+  logKey(AsyncReadKB(kb5, scheduler), log);
+  logKey(AsyncReadKB(kb6, scheduler), log);
+  errorIf(write(fds4[1], "\033", 1) != 1, "write");
+  errorIf(write(fds5[1], "x", 1) != 1, "write");
+  errorIf(write(fds6[1], "k", 1) != 1, "write");
+  scheduler.run();
+  std::string order;
+  for (const std::string &name : log) {
+    order += name + " ";
+  }
+  st |= testEq(order, "k Esc x ", "Keys in order of waits");
+
+  // Display Test Statuses
+  return reportTests(st);
+}
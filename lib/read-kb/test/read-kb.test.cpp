@@ -6,11 +6,15 @@
  */
 
 #include "read-kb.h"
+#include "test-util.h"
 
 #include <fcntl.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -18,42 +22,12 @@
 #include <utility>
 #include <vector>
 
-#define ANSI_RED "\033[31m"
-#define ANSI_GRN "\033[32m"
-#define ANSI_RST "\033[0m"
-
-#define U_LA "\u27e8" //!< Left Angle Bracket
-#define U_RA "\u27e9" //!< Right Angle Bracket
-
-// Define error-handling function
-#define errorIf(cond, msg) do { if( cond ) { \
-                                  perror(msg); exit(EXIT_FAILURE); \
-                              }} while (0)
-
 // Check that global namespace is not polluted
 enum TestEnum {
   Enter,
   UNDEFINED
 };
 
-int failTest( std::string ansString,
-              std::string resultString,
-              std::string description ) {
-  std::cout << ANSI_RED << "Test Failed: " << ANSI_RST;
-  std::cout << "Should be " U_LA << ansString << U_RA " but was " U_LA << resultString
-            << U_RA " : " << description << std::endl;
-  return EXIT_FAILURE;
-}
-
-int testEq( const std::string &result,
-            const std::string &answer,
-            const std::string &description = "No description") {
-  if( answer != result) {
-    return failTest(answer, result, description);
-  }
-  return EXIT_SUCCESS;
-}
-
 int main() {
 
   // Initialize exit status
@@ -147,6 +121,40 @@ int main() {
   }
   datafile.close();
 
+  // Decode a stream of every test sequence, in a shuffled order with repeats
+  std::string stream;
+  std::vector<std::string> streamKeys;
+  for (size_t ii = 0, jj = 0; ii < 4 * data.size(); ii++, jj = (jj * 7 + 3) % data.size()) {
+    stream += data[jj].second;
+    streamKeys.push_back(data[jj].first);
+  }
+  stream += "\033[200~x\033[201~\033[1;5X"; // Unknown parameters (bracketed paste), with modifiers
+  streamKeys.insert(streamKeys.end(), {"Undef-CSI", "x", "Undef-CSI", "Ctrl-Undef-CSI"});
+  stream += "\033\033OA\033O\033\033[\033"; // Sequences containing Esc
+  streamKeys.insert(streamKeys.end(), {"Alt-Up", "Undef-CSI", "Alt-[", "Esc"});
+  const u_char *streamBuf = reinterpret_cast<const u_char*>(stream.c_str());
+  const ssize_t streamLen = stream.length();
+  std::vector<bool> boundary(streamLen + 1, false);
+  size_t numKeys = 0;
+  for (ssize_t pos = 0; pos < streamLen; numKeys++) {
+    boundary[pos] = true;
+    ReadKB::Key key;
+    pos += ReadKB::decode(&streamBuf[pos], streamLen - pos, key);
+    std::ostringstream osKey;
+    osKey << key;
+    st |= testEq(osKey.str(), numKeys < streamKeys.size() ? streamKeys[numKeys] : "(none)", "Decode stream");
+  }
+  boundary[streamLen] = true;
+  st |= testEq(std::to_string(numKeys), std::to_string(streamKeys.size()), "Keys decoded from stream");
+
+  // Decoding may restart at any sync point without splitting a key
+  for (ssize_t pos = 0; pos <= streamLen; pos++) {
+    ssize_t sync = ReadKB::syncPoint(streamBuf, streamLen, pos);
+    if (sync < pos || !boundary[sync]) {
+      st |= failTest("key boundary", std::to_string(sync), "Sync point after " + std::to_string(pos));
+    }
+  }
+
   // Test reading input from a file (will read to end of file, so temp file used and filled incrementally)
   const std::string tempdir = "/tmp";
   int fd = open(tempdir.c_str(), O_RDWR | O_TMPFILE, S_IRUSR | S_IWUSR );
@@ -173,12 +181,179 @@ int main() {
     st |= testEq(os.str(), it->first, "Read input from file");
   }
 
-  // Display Test Statuses
-  std::cout << (st ? ANSI_RED : ANSI_GRN)
-            << std::string(15, '#')
-            << " Tests " << (st ? "Failed!" : "Passed!") << " "
-            << std::string(15, '#')
-            << ANSI_RST << std::endl;
+  // Read several keys queued in a single buffer (e.g. a held arrow key)
+  const std::string repeats = "\033[A\033[A\033[A\033[1;5B\033[1;5Bxx";
+  errorIf((s = write(fd, repeats.c_str(), repeats.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"Up", "Up", "Up", "Ctrl-Down", "Ctrl-Down", "x", "x"}) {
+    os.str("");
+    os << kb.read_key();
+    st |= testEq(os.str(), ans, "Read queued keys");
+  }
+
+  // Coalesce queued repeats of navigation keys only
+  kb.setCoalescing(true, 0, ReadKB::KeyClass::Navigation);
+  errorIf((s = write(fd, repeats.c_str(), repeats.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"Up x3", "Ctrl-Down x2", "x x1", "x x1"}) {
+    uint count;
+    os.str("");
+    os << kb.read_key(count);
+    os << " x" << count;
+    st |= testEq(os.str(), ans, "Coalesce navigation keys");
+  }
+
+  // Coalesce queued repeats of any key
+  kb.setCoalescing(true);
+  errorIf((s = write(fd, repeats.c_str(), repeats.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"Up x3", "Ctrl-Down x2", "x x2"}) {
+    uint count;
+    os.str("");
+    os << kb.read_key(count);
+    os << " x" << count;
+    st |= testEq(os.str(), ans, "Coalesce any key");
+  }
+  kb.setCoalescing(false);
 
-  return st;
+  // An unknown sequence is an error, but only the end of input sets eof()
+  const std::string unknown = "\033[1~";
+  errorIf((s = write(fd, unknown.c_str(), unknown.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"Error", "Error EOF"}) {
+    os.str("");
+    os << kb.read_key() << (kb.eof() ? " EOF" : "");
+    st |= testEq(os.str(), ans, "End of input");
+  }
+
+  // Send queries to a pipe, standing in for the terminal
+  int query_fds[2];
+  errorIf(pipe(query_fds) == -1, "pipe");
+  kb.setOutput(query_fds[1]);
+  std::string cursor;
+  auto showReply = [](const ReadKB::Reply &reply) {
+    std::string str = reply.status == ReadKB::Reply::Status::Ok ? "Ok" : "Not Ok";
+    for (size_t ii = 0; ii < reply.count; ii++) {
+      str += " " + std::to_string(reply.params[ii]);
+    }
+    return str;
+  };
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  std::future<ReadKB::Reply> attributes = kb.query(ReadKB::Query::PrimaryAttributes);
+  char query_buf[16];
+  errorIf((s = read(query_fds[0], query_buf, sizeof(query_buf))) == -1, "read");
+  st |= testEq(std::string(query_buf, s), "\033[6n\033[c", "Queries sent");
+
+  // Replies are taken out of the input, leaving keys in order; unawaited, a cursor report is Ctrl-F3,
+  // and a parameter that is not a modifier makes an undefined key
+  const std::string replies = "a\033[12;40Rb\033[?62;22cc\033[1;5R\033[1;9A";
+  errorIf((s = write(fd, replies.c_str(), replies.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"a", "b", "c", "Ctrl-F3", "Undef-CSI"}) {
+    os.str("");
+    os << kb.read_key();
+    st |= testEq(os.str(), ans, "Read keys around replies");
+  }
+  st |= testEq(cursor, "Ok 12 40", "Cursor position reply");
+  st |= testEq(attributes.wait_for(std::chrono::seconds(0)) == std::future_status::ready
+               ? showReply(attributes.get()) : "Not ready", "Ok 62 22", "Device attributes reply");
+
+  // Deliver replies without taking keys, including one directly after an Esc key
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  const std::string pumped = "\033\033[3;4Rx";
+  errorIf((s = write(fd, pumped.c_str(), pumped.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  st |= testEq(kb.pump(0) ? "Read" : "Not read", "Read", "Pump input");
+  st |= testEq(cursor, "Ok 3 4", "Pumped cursor position reply");
+  os.str("");
+  os << kb.read_key();
+  st |= testEq(os.str(), "Esc", "Key before pumped reply");
+  os.str("");
+  os << kb.read_key();
+  st |= testEq(os.str(), "x", "Key after pumped reply");
+
+  // The Esc key stays alone when the reply is routed as the key is read too
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  const std::string between = "\033\033[5;6R\033[Ax";
+  errorIf((s = write(fd, between.c_str(), between.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  for (const std::string ans : {"Esc", "Up", "x"}) {
+    os.str("");
+    os << kb.read_key();
+    st |= testEq(os.str(), ans, "Read keys around a reply after Esc");
+  }
+  st |= testEq(cursor, "Ok 5 6", "Cursor position reply after Esc");
+
+  // A reply read by itself leaves no key, so reading goes on (here to the end of the file)
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  const std::string alone = "\033[5;6R";
+  errorIf((s = write(fd, alone.c_str(), alone.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  os.str("");
+  os << kb.read_key();
+  st |= testEq(os.str(), "Error", "Read past a reply alone");
+  st |= testEq(cursor, "Ok 5 6", "Cursor position reply alone");
+
+  // Likewise while waiting for repeats, with the keys filling the buffer so the reply is read alone
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  const std::string held = std::string(ReadKB::kBufferSize, 'x') + "\033[7;8R";
+  errorIf((s = write(fd, held.c_str(), held.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  kb.setCoalescing(true, 1000);
+  uint count;
+  os.str("");
+  os << kb.read_key(count) << " x" << count;
+  kb.setCoalescing(false);
+  st |= testEq(os.str(), "x x" + std::to_string(ReadKB::kBufferSize), "Coalesce past a reply alone");
+  st |= testEq(cursor, "Ok 7 8", "Cursor position reply while coalescing");
+
+  // Pumping delivers a reply behind typed-ahead keys, and an extended cursor report leaves a real Ctrl-F3 alone
+  kb.query(ReadKB::Query::ExtendedCursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  char sent_buf[64];
+  errorIf((s = read(query_fds[0], sent_buf, sizeof(sent_buf))) < 5, "read");
+  st |= testEq(std::string(&sent_buf[s - 5], 5), "\033[?6n", "Extended cursor position query sent");
+  const std::string typeahead = std::string(100, 'y') + "\033[1;5R\033[?9;10;1R";
+  errorIf((s = write(fd, typeahead.c_str(), typeahead.length())) == -1, "write");
+  errorIf(lseek(fd, -s, SEEK_CUR) == -1, "lseek");
+  st |= testEq(kb.pump(0) ? "Read" : "Not read", "Read", "Pump past typed-ahead keys");
+  st |= testEq(cursor, "Ok 9 10 1", "Extended cursor position reply");
+  kb.setCoalescing(true);
+  for (const std::string ans : {"y x100", "Ctrl-F3 x1"}) {
+    os.str("");
+    os << kb.read_key(count) << " x" << count;
+    st |= testEq(os.str(), ans, "Keys before extended reply");
+  }
+  kb.setCoalescing(false);
+
+  // A reply split across reads is waited for (briefly) instead of being decoded as keys
+  int split_fds[2];
+  errorIf(pipe(split_fds) == -1, "pipe");
+  kb.setInput(split_fds[0], ReadKB::InputMode::Char);
+  kb.query(ReadKB::Query::CursorPosition, [&](const ReadKB::Reply &reply) { cursor = showReply(reply); });
+  errorIf(write(split_fds[1], "\033[12;", 5) != 5, "write");
+  pid_t pid = fork();
+  errorIf(pid == -1, "fork");
+  if (pid == 0) {
+    usleep(20000);
+    _exit(write(split_fds[1], "34Rk", 4) == 4 ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  os.str("");
+  os << kb.read_key();
+  st |= testEq(os.str(), "k", "Key after split reply");
+  st |= testEq(cursor, "Ok 12 34", "Split cursor position reply");
+  int child_status;
+  errorIf(waitpid(pid, &child_status, 0) == -1, "waitpid");
+  kb.setInput(fd, ReadKB::InputMode::Char);
+  close(split_fds[0]);
+  close(split_fds[1]);
+
+  // Queries the terminal never answers can be cancelled
+  std::future<ReadKB::Reply> status = kb.query(ReadKB::Query::DeviceStatus);
+  kb.cancelQueries();
+  st |= testEq(showReply(status.get()), "Not Ok", "Cancel query");
+  close(query_fds[0]);
+  close(query_fds[1]);
+
+  // Display Test Statuses
+  return reportTests(st);
 }
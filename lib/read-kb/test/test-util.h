@@ -0,0 +1,64 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+// Reporting helpers shared by the library tests
+
+#include "error-if.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#define ANSI_RED "\033[31m"
+#define ANSI_GRN "\033[32m"
+#define ANSI_RST "\033[0m"
+
+#define U_LA "\u27e8" //!< Left Angle Bracket
+#define U_RA "\u27e9" //!< Right Angle Bracket
+
+inline int failTest( std::string ansString,
+                     std::string resultString,
+                     std::string description ) {
+  std::cout << ANSI_RED << "Test Failed: " << ANSI_RST;
+  std::cout << "Should be " U_LA << ansString << U_RA " but was " U_LA << resultString
+            << U_RA " : " << description << std::endl;
+  return EXIT_FAILURE;
+}
+
+inline int testEq( const std::string &result,
+                   const std::string &answer,
+                   const std::string &description = "No description") {
+  if( answer != result) {
+    return failTest(answer, result, description);
+  }
+  return EXIT_SUCCESS;
+}
+
+inline int testEq( const uint64_t &result,
+                   const uint64_t &answer,
+                   const std::string &description = "No description") {
+  if( answer != result) {
+    return failTest(std::to_string(answer), std::to_string(result), description);
+  }
+  return EXIT_SUCCESS;
+}
+
+/// Display the overall test status, returning it as the exit status
+inline int reportTests(const int &st) {
+  std::cout << (st ? ANSI_RED : ANSI_GRN)
+            << std::string(15, '#')
+            << " Tests " << (st ? "Failed!" : "Passed!") << " "
+            << std::string(15, '#')
+            << ANSI_RST << std::endl;
+  return st;
+}
+
+#endif // TEST_UTIL_H
@@ -0,0 +1,31 @@
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#
+# Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+
+# Check that ANALYZE reports the same histograms for LOG serially and in parallel,
+# and that they match the contents of EXPECTED
+
+execute_process(
+  COMMAND "${ANALYZE}" --threads 1 "${LOG}" "${LOG}"
+  OUTPUT_VARIABLE serial
+  RESULT_VARIABLE serial_result
+)
+execute_process(
+  COMMAND "${ANALYZE}" --threads 8 --chunk-size 16 "${LOG}" "${LOG}"
+  OUTPUT_VARIABLE parallel
+  RESULT_VARIABLE parallel_result
+)
+
+if(NOT serial_result EQUAL 0 OR NOT parallel_result EQUAL 0)
+  message(FATAL_ERROR "read-kb-analyze failed: ${serial_result} ${parallel_result}")
+endif()
+if(NOT serial STREQUAL parallel)
+  message(FATAL_ERROR "Parallel decode differs from serial decode:\n${serial}\n---\n${parallel}")
+endif()
+file(READ "${EXPECTED}" expected)
+if(NOT serial STREQUAL expected)
+  message(FATAL_ERROR "Histograms differ from ${EXPECTED}:\n${serial}")
+endif()
+message("${parallel}")
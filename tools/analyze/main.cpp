@@ -0,0 +1,193 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+// Decode logs of raw terminal input in parallel and report key, modifier, and
+// error histograms. Each log is mapped into memory and split into chunks at
+// ReadKB::syncPoint() positions, so the chunks decode to the same keys as the
+// whole log would.
+
+#include "error-if.h"
+#include "read-kb.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Keys with modifiers are below this value; error codes are above it
+#define NUM_KEY_VALUES (1<<10)
+
+struct Histogram {
+  uint64_t bytes = 0;
+  uint64_t keys  = 0;
+  std::array<uint64_t, NUM_KEY_VALUES> key = {};
+  std::array<uint64_t, 8> modifiers = {}; ///< Indexed by ReadKB::Key::modifiers()
+  std::array<uint64_t, ReadKB::Key::UNDEFINED - ReadKB::Key::ERROR + 1> error = {};
+
+  Histogram& operator+=(const Histogram &other) {
+    bytes += other.bytes;
+    keys  += other.keys;
+    for (size_t ii = 0; ii < key.size(); ii++)        { key[ii] += other.key[ii]; }
+    for (size_t ii = 0; ii < modifiers.size(); ii++)  { modifiers[ii] += other.modifiers[ii]; }
+    for (size_t ii = 0; ii < error.size(); ii++)      { error[ii] += other.error[ii]; }
+    return *this;
+  }
+};
+
+struct Chunk {
+  const u_char *buf;
+  ssize_t       len;
+};
+
+static void decodeChunk(const Chunk &chunk, Histogram &hist) {
+  ReadKB::Key key;
+  for (ssize_t pos = 0; pos < chunk.len; ) {
+    pos += ReadKB::decode(&chunk.buf[pos], chunk.len - pos, key);
+    hist.keys++;
+    hist.modifiers[key.modifiers()]++;
+    // Error codes may carry modifiers too (e.g. Ctrl-Undef-CSI), so classify them without
+    const ReadKB::Key base = key.base();
+    if (base >= ReadKB::Key::ERROR) {
+      hist.error[std::min<size_t>(base - ReadKB::Key::ERROR, hist.error.size() - 1)]++;
+    } else {
+      hist.key[key]++;
+    }
+  }
+  hist.bytes += chunk.len;
+}
+
+static std::string keyName(const ReadKB::Key &key) {
+  char name[ReadKB::Key::kMaxNameLength];
+  key.format(name, sizeof(name));
+  return name;
+}
+
+/// Print the non-zero entries of a histogram, most frequent first
+static void printCounts(const char *title, std::vector<std::pair<uint64_t, std::string>> counts) {
+  std::stable_sort(counts.begin(), counts.end(),
+                   [](const auto &a, const auto &b) { return a.first > b.first; });
+  std::cout << title << ":\n";
+  for (const auto &count : counts) {
+    if (count.first > 0) {
+      std::cout << "  " << count.first << "\t" << count.second << '\n';
+    }
+  }
+}
+
+static void usage(const char *prog) {
+  std::cerr << "Usage: " << prog << " [--threads N] [--chunk-size BYTES] LOG..." << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned threads = std::thread::hardware_concurrency();
+  ssize_t chunk_size = 16 << 20;
+  std::vector<const char*> paths;
+  for (int ii = 1; ii < argc; ii++) {
+    if (strcmp(argv[ii], "--threads") == 0 && ii + 1 < argc) {
+      threads = strtoul(argv[++ii], nullptr, 10);
+    } else if (strcmp(argv[ii], "--chunk-size") == 0 && ii + 1 < argc) {
+      chunk_size = strtoll(argv[++ii], nullptr, 10);
+    } else if (argv[ii][0] == '-') {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      paths.push_back(argv[ii]);
+    }
+  }
+  if (paths.empty() || chunk_size <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  threads = threads > 0 ? threads : 1;
+
+  // Map every log and split it into chunks; logs are independent sessions, so never share a chunk
+  std::vector<std::pair<void*, size_t>> maps;
+  std::vector<Chunk> chunks;
+  for (const char *path : paths) {
+    int fd = open(path, O_RDONLY);
+    errorIf(fd == -1, path);
+    struct stat st;
+    errorIf(fstat(fd, &st) == -1, path);
+    if (st.st_size == 0) {
+      close(fd);
+      continue;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    errorIf(addr == MAP_FAILED, path);
+    close(fd);
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    maps.emplace_back(addr, st.st_size);
+
+    const u_char *buf = static_cast<const u_char*>(addr);
+    const ssize_t len = st.st_size;
+    for (ssize_t begin = 0; begin < len; ) {
+      ssize_t end = begin + chunk_size < len ? ReadKB::syncPoint(buf, len, begin + chunk_size) : len;
+      chunks.push_back(Chunk{&buf[begin], end - begin});
+      begin = end;
+    }
+  }
+
+  // Decode chunks on a pool of threads, each with its own histogram
+  threads = std::min<size_t>(threads, std::max<size_t>(chunks.size(), 1));
+  std::vector<Histogram> hists(threads);
+  std::atomic<size_t> next_chunk{0};
+  std::vector<std::thread> pool;
+  for (unsigned ii = 0; ii < threads; ii++) {
+    pool.emplace_back([&, ii]() {
+      for (size_t jj = next_chunk++; jj < chunks.size(); jj = next_chunk++) {
+        decodeChunk(chunks[jj], hists[ii]);
+      }
+    });
+  }
+  Histogram total;
+  for (unsigned ii = 0; ii < threads; ii++) {
+    pool[ii].join();
+    total += hists[ii];
+  }
+  for (const auto &map : maps) {
+    munmap(map.first, map.second);
+  }
+
+  // Report
+  std::cout << "Bytes: " << total.bytes << "\nKeys: " << total.keys << "\n";
+
+  std::vector<std::pair<uint64_t, std::string>> counts;
+  for (uint ii = 0; ii < NUM_KEY_VALUES; ii++) {
+    counts.emplace_back(total.key[ii], keyName(ReadKB::Key(ii)));
+  }
+  printCounts("Keys", counts);
+
+  counts.clear();
+  for (uint ii = 0; ii < total.modifiers.size(); ii++) {
+    std::string name;
+    if (ii & ReadKB::Key::CtrlBit) { name += "Ctrl-"; }
+    if (ii & ReadKB::Key::AltBit)  { name += "Alt-"; }
+    if (ii & ReadKB::Key::ShftBit) { name += "Shft-"; }
+    counts.emplace_back(total.modifiers[ii], name.empty() ? "None" : name.substr(0, name.length() - 1));
+  }
+  printCounts("Modifiers", counts);
+
+  counts.clear();
+  for (uint ii = 0; ii < total.error.size(); ii++) {
+    counts.emplace_back(total.error[ii], keyName(ReadKB::Key(ReadKB::Key::ERROR + ii)));
+  }
+  printCounts("Errors", counts);
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}
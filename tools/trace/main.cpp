@@ -0,0 +1,56 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * Copyright (c) 2023, Jeremy Goossen jeremyg995@gmail.com
+ */
+
+// Decode a binary trace dumped by KeyTrace (e.g. READ_KB_TRACE=/tmp/trace.bin read-kb)
+
+#include "key-trace.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " TRACE-FILE" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ifstream file(argv[1], std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << argv[1] << ": " << strerror(errno) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  KeyTrace::DumpHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      header.magic != KeyTrace::kMagic ||
+      header.version != KeyTrace::kVersion ||
+      header.record_size != sizeof(KeyTrace::Record)) {
+    std::cerr << argv[1] << ": not a read-kb trace" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Times are shown relative to the first record
+  KeyTrace::Record record;
+  uint64_t start = 0;
+  for (uint32_t ii = 0; ii < header.count; ii++) {
+    if (!file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+      std::cerr << argv[1] << ": truncated after " << ii << " records" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (start == 0) {
+      start = record.timestamp;
+    }
+    record.timestamp -= record.timestamp >= start ? start : record.timestamp;
+    std::cout << record << '\n';
+  }
+  std::cout << std::flush;
+
+  return EXIT_SUCCESS;
+}